@@ -0,0 +1,258 @@
+#include <QHeaderView>
+#include <QItemSelectionModel>
+#include <QScrollBar>
+#include <QStatusBar>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "fileinfomodel.h"
+#include "filelist.h"
+#include "session.h"
+#include "statusmessage.h"
+#include "treegenerator.h"
+
+Q_DECLARE_METATYPE(TreeGenerator::Parameters)
+
+/// Hot paths of the collection and the model
+/// Run with '-o results.xml,xml' (or ',csv') to get machine-readable results
+class Benchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void collect_data();
+    void collect();
+
+    void modelAdd_data();
+    void modelAdd();
+
+    void modelRemove_data();
+    void modelRemove();
+
+    void selectNextDuplicates_data();
+    void selectNextDuplicates();
+
+    void sort_data();
+    void sort();
+
+    void scroll_data();
+    void scroll();
+
+    void openSession_data();
+    void openSession();
+
+private:
+    /// Rows with the given number of synthetic items
+    static void addSizes(const QList<int>& sizes, double duplicates = 0.2);
+
+    /// The list filled with synthetic items through a session file
+    void fill(FileList* list, const TreeGenerator::Parameters& parameters);
+
+    QStatusBar mStatusBar;
+    QTemporaryDir mTemp;
+};
+
+void Benchmark::initTestCase()
+{
+    StatusMessage::setStatusBar(&mStatusBar);
+    QVERIFY(mTemp.isValid());
+}
+
+void Benchmark::addSizes(const QList<int>& sizes, double duplicates)
+{
+    QTest::addColumn<TreeGenerator::Parameters>("parameters");
+
+    for (int size: sizes)
+    {
+        TreeGenerator::Parameters parameters;
+        parameters.files = size;
+        parameters.duplicates = duplicates;
+        QTest::newRow(qPrintable(QString("%1 files").arg(size))) << parameters;
+    }
+}
+
+void Benchmark::fill(FileList* list, const TreeGenerator::Parameters& parameters)
+{
+    Session session;
+    session.items = TreeGenerator::items(parameters);
+
+    const auto fileName = mTemp.filePath("fill.mdsession");
+    QVERIFY(session.save(fileName));
+
+    ScanOptions options;
+    options.validateSessions = false;
+    list->setOptions(options);
+    QVERIFY(list->openSession(fileName));
+}
+
+void Benchmark::collect_data()
+{
+    QTest::addColumn<TreeGenerator::Parameters>("parameters");
+
+    TreeGenerator::Parameters small;
+    small.files = 2000;
+    small.maxSize = 4 * 1024;
+    QTest::newRow("2000 small files") << small;
+
+    TreeGenerator::Parameters mixed;
+    mixed.files = 500;
+    mixed.maxSize = 4 * 1024 * 1024;
+    QTest::newRow("500 files up to 4 MB") << mixed;
+
+    TreeGenerator::Parameters copies;
+    copies.files = 2000;
+    copies.maxSize = 4 * 1024;
+    copies.duplicates = 0.8;
+    QTest::newRow("2000 small files, 80% copies") << copies;
+}
+
+void Benchmark::collect()
+{
+    QFETCH(TreeGenerator::Parameters, parameters);
+
+    const auto root = mTemp.filePath(QTest::currentDataTag());
+    QVERIFY(TreeGenerator::generate(root, parameters));
+
+    QBENCHMARK {
+        FileInfoModel::Collector collector(nullptr, ScanOptions());
+        collector.collect({ QUrl::fromLocalFile(root) });
+        QCOMPARE(collector.collected().size(), parameters.files);
+    }
+}
+
+void Benchmark::modelAdd_data()
+{
+    addSizes({ 1000, 10000, 100000 });
+}
+
+void Benchmark::modelAdd()
+{
+    QFETCH(TreeGenerator::Parameters, parameters);
+    const auto items = TreeGenerator::items(parameters);
+
+    QBENCHMARK {
+        FileInfoModel model;
+        model.add(items);
+    }
+}
+
+void Benchmark::modelRemove_data()
+{
+    addSizes({ 1000, 10000, 100000 });
+}
+
+void Benchmark::modelRemove()
+{
+    QFETCH(TreeGenerator::Parameters, parameters);
+
+    FileInfoModel model;
+    model.add(TreeGenerator::items(parameters));
+
+    std::set<int, std::greater<int>> rows; // every other row
+    for (int row = 0; row < parameters.files; row += 2)
+        rows.insert(row);
+
+    QBENCHMARK_ONCE {
+        model.remove(rows);
+    }
+}
+
+void Benchmark::selectNextDuplicates_data()
+{
+    addSizes({ 1000, 10000 }, 0.01);
+}
+
+void Benchmark::selectNextDuplicates()
+{
+    QFETCH(TreeGenerator::Parameters, parameters);
+
+    FileList list(nullptr);
+    fill(&list, parameters);
+
+    QBENCHMARK {
+        list.selectionModel()->clear();
+        list.selectNextDuplicates(FileInfoModel::eHash);
+    }
+}
+
+void Benchmark::sort_data()
+{
+    addSizes({ 10000, 100000 });
+}
+
+void Benchmark::sort()
+{
+    QFETCH(TreeGenerator::Parameters, parameters);
+
+    FileList list(nullptr);
+    fill(&list, parameters);
+    list.setSortingEnabled(true);
+
+    QBENCHMARK {
+        for (int column: { FileInfoModel::eName, FileInfoModel::eSize, FileInfoModel::eHash })
+        {
+            list.sortByColumn(column, Qt::AscendingOrder);
+            list.sortByColumn(column, Qt::DescendingOrder);
+        }
+    }
+}
+
+void Benchmark::scroll_data()
+{
+    addSizes({ 10000, 100000 });
+}
+
+void Benchmark::scroll()
+{
+    QFETCH(TreeGenerator::Parameters, parameters);
+
+    FileList list(nullptr);
+    fill(&list, parameters);
+    list.resize(800, 600);
+    list.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&list));
+
+    auto bar = list.verticalScrollBar();
+
+    QBENCHMARK {
+        // 100 pages from the top to the bottom
+        for (int page = 0; page <= 100; ++page)
+        {
+            bar->setValue(bar->maximum() * page / 100);
+            list.viewport()->repaint();
+        }
+    }
+}
+
+void Benchmark::openSession_data()
+{
+    addSizes({ 10000, 100000 });
+}
+
+void Benchmark::openSession()
+{
+    QFETCH(TreeGenerator::Parameters, parameters);
+
+    Session session;
+    session.items = TreeGenerator::items(parameters);
+
+    const auto fileName = mTemp.filePath("open.mdsession");
+    QVERIFY(session.save(fileName));
+
+    // the list shows the session through the model, so adding the items is a part of opening
+    QBENCHMARK {
+        Session loaded;
+        QVERIFY(loaded.load(fileName));
+        QCOMPARE(loaded.items.size(), parameters.files);
+
+        FileInfoModel model;
+        model.add(loaded.items, loaded.collapsed);
+        QCOMPARE(model.rowCount(), parameters.files);
+    }
+}
+
+QTEST_MAIN(Benchmark)
+
+#include "benchmark.moc"
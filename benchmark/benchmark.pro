@@ -0,0 +1,64 @@
+#-------------------------------------------------
+#
+# Benchmarks of the collection and the model hot paths
+#
+# Build and run:
+#   qmake benchmark.pro && make && ./multidiff-benchmark -o results.xml,xml
+# Use -platform offscreen on machines without display
+#
+#-------------------------------------------------
+
+QT       += core gui widgets concurrent network testlib
+
+TARGET = multidiff-benchmark
+TEMPLATE = app
+CONFIG += c++14 console testcase
+CONFIG -= app_bundle
+
+LIBS += -lz
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += \
+    ../source \
+
+SOURCES += \
+    benchmark.cpp \
+    treegenerator.cpp \
+    ../source/archivereader.cpp \
+    ../source/dirwatcher.cpp \
+    ../source/externalsort.cpp \
+    ../source/fileinfomodel.cpp \
+    ../source/filelist.cpp \
+    ../source/imagehash.cpp \
+    ../source/ioscheduler.cpp \
+    ../source/profiler.cpp \
+    ../source/progress.cpp \
+    ../source/referencecache.cpp \
+    ../source/scanfilter.cpp \
+    ../source/session.cpp \
+    ../source/shardedscan.cpp \
+    ../source/sparsefile.cpp \
+    ../source/statusmessage.cpp \
+    ../source/throttle.cpp \
+    ../source/treehash.cpp
+
+HEADERS += \
+    treegenerator.h \
+    ../source/archivereader.h \
+    ../source/dirwatcher.h \
+    ../source/externalsort.h \
+    ../source/fileinfomodel.h \
+    ../source/filelist.h \
+    ../source/imagehash.h \
+    ../source/ioscheduler.h \
+    ../source/profiler.h \
+    ../source/progress.h \
+    ../source/referencecache.h \
+    ../source/scanfilter.h \
+    ../source/session.h \
+    ../source/shardedscan.h \
+    ../source/sparsefile.h \
+    ../source/statusmessage.h \
+    ../source/throttle.h \
+    ../source/treehash.h
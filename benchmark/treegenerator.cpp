@@ -0,0 +1,87 @@
+#include "treegenerator.h"
+
+#include <cmath>
+#include <vector>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QRandomGenerator>
+
+#include "fileinfomodel.h"
+
+QList<TreeGenerator::File> TreeGenerator::files(const Parameters& parameters)
+{
+    QRandomGenerator random(parameters.seed);
+    const double logMin = std::log(static_cast<double>(parameters.minSize));
+    const double logMax = std::log(static_cast<double>(parameters.maxSize));
+
+    QList<File> files;
+    files.reserve(parameters.files);
+
+    for (int i = 0; i < parameters.files; ++i)
+    {
+        File file;
+        file.path = QString("d%1/f%2").arg(i / parameters.filesPerDir, 5, 10, QChar('0')).arg(i, 8, 10, QChar('0'));
+
+        if (!files.isEmpty() && random.generateDouble() < parameters.duplicates)
+        {
+            const auto& original = files[random.bounded(files.size())];
+            file.size = original.size;
+            file.contentSeed = original.contentSeed;
+        }
+        else
+        {
+            file.size = static_cast<qint64>(std::exp(logMin + (logMax - logMin) * random.generateDouble()));
+            file.contentSeed = random.generate();
+        }
+
+        files.append(file);
+    }
+
+    return files;
+}
+
+bool TreeGenerator::generate(const QString& root, const Parameters& parameters)
+{
+    std::vector<quint32> buffer;
+
+    for (const auto& file: files(parameters))
+    {
+        const auto path = root + '/' + file.path;
+        if (!QDir().mkpath(QFileInfo(path).absolutePath()))
+            return false;
+
+        QFile out(path);
+        if (!out.open(QIODevice::WriteOnly))
+            return false;
+
+        buffer.resize(static_cast<size_t>(file.size + 3) / 4);
+        QRandomGenerator content(file.contentSeed);
+        content.fillRange(buffer.data(), static_cast<qsizetype>(buffer.size()));
+
+        if (out.write(reinterpret_cast<const char*>(buffer.data()), file.size) != file.size)
+            return false;
+    }
+
+    return true;
+}
+
+QList<FileItem> TreeGenerator::items(const Parameters& parameters)
+{
+    const QDateTime lastModified = QDateTime::fromMSecsSinceEpoch(1558108984000);
+
+    QList<FileItem> items;
+    for (const auto& file: files(parameters))
+    {
+        // the hash of the content seed is as unique as the hash of the content
+        const auto seed = QByteArray::number(file.contentSeed) + '/' + QByteArray::number(file.size);
+        FileItem item{ QFileInfo("/synthetic/" + file.path), QCryptographicHash::hash(seed, QCryptographicHash::Sha1) };
+        item.size = file.size;
+        item.lastModified = lastModified;
+        items.append(item);
+    }
+
+    return items;
+}
@@ -0,0 +1,40 @@
+#ifndef TREEGENERATOR_H
+#define TREEGENERATOR_H
+
+#include <QList>
+#include <QString>
+
+struct FileItem;
+
+/// Deterministic synthetic file trees: the same parameters always give the same files
+class TreeGenerator
+{
+public:
+    struct Parameters
+    {
+        int files = 1000;
+        int filesPerDir = 50;
+        qint64 minSize = 1; ///< File sizes are log-uniformly distributed in [minSize, maxSize]
+        qint64 maxSize = 64 * 1024;
+        double duplicates = 0.2; ///< The fraction of files which are copies of other files
+        quint32 seed = 1;
+    };
+
+    /// Create the files under root; returns false on I/O error
+    static bool generate(const QString& root, const Parameters& parameters);
+
+    /// Items of the same tree without creating any files, for model benchmarks
+    static QList<FileItem> items(const Parameters& parameters);
+
+private:
+    struct File
+    {
+        QString path; ///< Relative to the root
+        qint64 size;
+        quint32 contentSeed; ///< Copies have the same content seed
+    };
+
+    static QList<File> files(const Parameters& parameters);
+};
+
+#endif // TREEGENERATOR_H
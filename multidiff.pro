@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -24,30 +24,85 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 CONFIG += c++14
 
+# archive members are inflated by ArchiveReader
+LIBS += -lz
+
 INCLUDEPATH += \
     source \
 
 SOURCES += \
+    source/archivereader.cpp \
+    source/dirwatcher.cpp \
+    source/externalsort.cpp \
     source/fileinfomodel.cpp \
     source/filelist.cpp \
+    source/imagehash.cpp \
+    source/ioscheduler.cpp \
     source/main.cpp \
     source/mainwindow.cpp \
+    source/profiler.cpp \
+    source/profilerpanel.cpp \
+    source/progress.cpp \
+    source/progresspanel.cpp \
+    source/referencecache.cpp \
+    source/scanfilter.cpp \
+    source/session.cpp \
     source/settingsdialog.cpp \
-    source/statusmessage.cpp
+    source/shardedscan.cpp \
+    source/sparsefile.cpp \
+    source/statusmessage.cpp \
+    source/throttle.cpp \
+    source/treehash.cpp
 
 HEADERS += \
     source/abstractsettings.h \
+    source/archivereader.h \
+    source/bktree.h \
+    source/dirwatcher.h \
+    source/externalsort.h \
     source/fileinfomodel.h \
     source/filelist.h \
+    source/imagehash.h \
+    source/ioscheduler.h \
     source/mainwindow.h \
+    source/profiler.h \
+    source/profilerpanel.h \
+    source/progress.h \
+    source/progresspanel.h \
+    source/referencecache.h \
+    source/scanfilter.h \
+    source/scanoptions.h \
+    source/session.h \
     source/settingsdialog.h \
+    source/shardedscan.h \
+    source/sparsefile.h \
     source/statusmessage.h \
+    source/throttle.h \
+    source/treehash.h \
     source/widgetlocker.h
 
 FORMS += \
     source/mainwindow.ui \
     source/settingsdialog.ui
 
+# 'make benchmark' builds and runs benchmark/benchmark.pro, results go to benchmark.xml
+unix {
+    benchmark.commands = \
+        mkdir -p $$OUT_PWD/benchmark && cd $$OUT_PWD/benchmark && \
+        $(QMAKE) $$PWD/benchmark/benchmark.pro && $(MAKE) && \
+        ./multidiff-benchmark -platform offscreen -o $$OUT_PWD/benchmark.xml,xml
+    QMAKE_EXTRA_TARGETS += benchmark
+}
+
+# 'make check' builds and runs tests/tests.pro
+unix {
+    check.commands = \
+        mkdir -p $$OUT_PWD/tests && cd $$OUT_PWD/tests && \
+        $(QMAKE) $$PWD/tests/tests.pro && $(MAKE) && \
+        ./multidiff-tests -platform offscreen
+    QMAKE_EXTRA_TARGETS += check
+}
+
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
@@ -0,0 +1,656 @@
+#include "archivereader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QObject>
+#include <QStringList>
+#include <QtEndian>
+
+#include <zlib.h>
+
+#include "profiler.h"
+#include "scanfilter.h"
+#include "throttle.h"
+#include "treehash.h"
+
+const char* const ArchiveReader::mcSeparator = "!/";
+
+namespace {
+
+constexpr int cBufferSize = 256 * 1024; ///< The same chunk size as for loose files
+constexpr int cInputSize = 64 * 1024; ///< Compressed data buffer
+constexpr int cBlock = 512; ///< tar block size
+constexpr qint64 cMaxExtendedHeader = 1024 * 1024; ///< GNU long names and pax headers, larger ones are damaged
+
+/// Sequential source of the archive data
+class Stream
+{
+public:
+    virtual ~Stream() = default;
+
+    /// Reads exactly size bytes unless the end is reached; -1 on error
+    virtual qint64 read(char* data, qint64 size) = 0;
+};
+
+/// Reads the file by large chunks through Throttle, so small tar and zip headers
+/// do not cost a system call and an I/O operation each
+class FileStream : public Stream
+{
+public:
+    FileStream(QFile* file, quint64 device) : mFile(file), mDevice(device), mBuffer(cBufferSize, Qt::Uninitialized) {}
+
+    qint64 read(char* data, qint64 size) override
+    {
+        qint64 total = 0;
+        while (total < size)
+        {
+            if (mPosition == mSize && !fill())
+                return mError ? -1 : total;
+
+            const qint64 length = std::min(size - total, mSize - mPosition);
+            memcpy(data + total, mBuffer.constData() + mPosition, static_cast<size_t>(length));
+            mPosition += length;
+            total += length;
+        }
+        return total;
+    }
+
+    /// Zip members are usually stored in the order of the central directory, so the
+    /// next member is often in the buffer already
+    bool seek(qint64 offset)
+    {
+        if (mSize > 0 && offset >= mBufferStart && offset <= mBufferStart + mSize)
+        {
+            mPosition = offset - mBufferStart;
+            return true;
+        }
+
+        mPosition = mSize = 0;
+        mBufferStart = offset;
+        return mFile->seek(offset);
+    }
+
+private:
+    bool fill()
+    {
+        qint64 length = 0;
+        {
+            Throttle::Read throttle(mDevice, mBuffer.size());
+            Profiler::Scope scope(Profiler::eRead);
+            mBufferStart = mFile->pos();
+            length = mFile->read(mBuffer.data(), mBuffer.size());
+        }
+
+        mError = length < 0;
+        mPosition = 0;
+        mSize = std::max<qint64>(length, 0);
+        return mSize > 0;
+    }
+
+    QFile* mFile;
+    const quint64 mDevice;
+    QByteArray mBuffer;
+    qint64 mBufferStart = 0; ///< The file offset of the buffer
+    qint64 mPosition = 0;
+    qint64 mSize = 0; ///< Valid bytes in the buffer
+    bool mError = false;
+};
+
+/// The given number of bytes of another stream
+class LimitedStream : public Stream
+{
+public:
+    LimitedStream(Stream* source, qint64 size) : mSource(source), mLeft(size) {}
+
+    qint64 read(char* data, qint64 size) override
+    {
+        const qint64 length = mSource->read(data, std::min(size, mLeft));
+        if (length > 0)
+            mLeft -= length;
+        return length;
+    }
+
+private:
+    Stream* mSource;
+    qint64 mLeft;
+};
+
+/// Decompresses gzip files and deflated zip members
+class InflateStream : public Stream
+{
+public:
+    enum Format { eRaw = -MAX_WBITS, eGzip = MAX_WBITS + 16 };
+
+    InflateStream(Stream* source, Format format) : mSource(source), mFormat(format), mInput(cInputSize, Qt::Uninitialized)
+    {
+        memset(&mStream, 0, sizeof(mStream));
+        mValid = inflateInit2(&mStream, format) == Z_OK;
+    }
+
+    ~InflateStream() override
+    {
+        if (mValid)
+            inflateEnd(&mStream);
+    }
+
+    InflateStream(const InflateStream&) = delete;
+    InflateStream& operator =(const InflateStream&) = delete;
+
+    qint64 read(char* data, qint64 size) override
+    {
+        if (!mValid)
+            return -1;
+
+        mStream.next_out = reinterpret_cast<Bytef*>(data);
+        mStream.avail_out = static_cast<uInt>(size);
+        while (mStream.avail_out > 0 && !mEnd)
+        {
+            if (mStream.avail_in == 0 && !fill())
+            {
+                if (mError)
+                    return -1;
+                mEnd = true; // truncated, the caller gets less data than expected
+                break;
+            }
+
+            const int result = inflate(&mStream, Z_NO_FLUSH);
+            if (result == Z_STREAM_END)
+                mEnd = !nextMember();
+            else if (result != Z_OK && result != Z_BUF_ERROR)
+                return -1;
+        }
+
+        return size - mStream.avail_out;
+    }
+
+private:
+    bool fill()
+    {
+        const qint64 length = mSource->read(mInput.data(), mInput.size());
+        mError = length < 0;
+        mStream.next_in = reinterpret_cast<Bytef*>(mInput.data());
+        mStream.avail_in = static_cast<uInt>(std::max<qint64>(length, 0));
+        return length > 0;
+    }
+
+    /// A gzip file may consist of several concatenated members
+    bool nextMember()
+    {
+        if (mFormat != eGzip)
+            return false;
+        if (mStream.avail_in == 0 && !fill())
+            return false;
+        if (*mStream.next_in != 0x1f) // trailing garbage, e.g. padding
+            return false;
+        return inflateReset(&mStream) == Z_OK;
+    }
+
+    Stream* mSource;
+    const Format mFormat;
+    QByteArray mInput;
+    z_stream mStream;
+    bool mValid = false;
+    bool mEnd = false;
+    bool mError = false;
+};
+
+/// Hash exactly size bytes of the stream; also calculate their CRC-32 if crc is given
+/// Members of the tree hash threshold or larger get a tree hash, so they match their loose copies
+bool hashData(Stream* stream, qint64 size, qint64 treeThreshold, QByteArray* buffer, QByteArray* hash,
+              quint32* crc = nullptr)
+{
+    uLong checksum = crc32(0, Z_NULL, 0);
+    const bool tree = treeThreshold > 0 && size >= treeThreshold;
+    QCryptographicHash calculator(QCryptographicHash::Sha1);
+    TreeHash::Calculator treeCalculator;
+    while (size > 0)
+    {
+        const qint64 length = stream->read(buffer->data(), std::min<qint64>(size, buffer->size()));
+        if (length <= 0)
+            return false;
+
+        Profiler::Scope scope(Profiler::eHash);
+        if (tree)
+            treeCalculator.addData(buffer->constData(), length);
+        else
+            calculator.addData(buffer->constData(), static_cast<int>(length));
+        if (crc)
+            checksum = crc32(checksum, reinterpret_cast<const Bytef*>(buffer->constData()), static_cast<uInt>(length));
+        size -= length;
+    }
+
+    *hash = tree ? treeCalculator.result() : calculator.result();
+    if (crc)
+        *crc = static_cast<quint32>(checksum);
+    return true;
+}
+
+bool skip(Stream* stream, qint64 size, QByteArray* buffer)
+{
+    while (size > 0)
+    {
+        const qint64 length = stream->read(buffer->data(), std::min<qint64>(size, buffer->size()));
+        if (length <= 0)
+            return false;
+        size -= length;
+    }
+    return true;
+}
+
+quint16 le16(const char* data) { return qFromLittleEndian<quint16>(data); }
+quint32 le32(const char* data) { return qFromLittleEndian<quint32>(data); }
+quint64 le64(const char* data) { return qFromLittleEndian<quint64>(data); }
+
+/// Octal, or big-endian base-256 for the values which do not fit (GNU extension)
+qint64 tarNumber(const char* field, int size)
+{
+    qint64 value = 0;
+    if (field[0] & 0x80)
+    {
+        value = field[0] & 0x7F;
+        for (int i = 1; i < size; ++i)
+            value = value << 8 | static_cast<uchar>(field[i]);
+        return value;
+    }
+
+    for (int i = 0; i < size && field[i]; ++i)
+    {
+        if (field[i] == ' ')
+            continue;
+        if (field[i] < '0' || field[i] > '7')
+            break;
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+QString tarString(const char* field, int size)
+{
+    return QString::fromUtf8(field, static_cast<int>(qstrnlen(field, static_cast<uint>(size))));
+}
+
+/// The checksum is the sum of the header bytes with the checksum field filled with spaces;
+/// some old implementations summed signed chars
+bool isTarHeader(const char* header)
+{
+    unsigned sum = 0;
+    int signedSum = 0;
+    for (int i = 0; i < cBlock; ++i)
+    {
+        const char c = i >= 148 && i < 156 ? ' ' : header[i];
+        sum += static_cast<uchar>(c);
+        signedSum += static_cast<signed char>(c);
+    }
+
+    const qint64 stored = tarNumber(header + 148, 8);
+    return stored == sum || stored == signedSum;
+}
+
+/// Records of the pax extended header: "<length> <key>=<value>\n"
+void parsePax(const QByteArray& data, QString* path, qint64* size, qint64* mtime)
+{
+    int position = 0;
+    while (position < data.size())
+    {
+        const int space = data.indexOf(' ', position);
+        if (space < 0)
+            return;
+
+        const int length = data.mid(position, space - position).toInt();
+        if (length <= space - position || position + length > data.size())
+            return;
+
+        const auto record = data.mid(space + 1, position + length - space - 2); // without '\n'
+        const int equal = record.indexOf('=');
+        const auto key = record.left(equal);
+        const auto value = record.mid(equal + 1);
+        if (key == "path")
+            *path = QString::fromUtf8(value);
+        else if (key == "size")
+            *size = value.toLongLong();
+        else if (key == "mtime")
+            *mtime = static_cast<qint64>(value.toDouble());
+
+        position += length;
+    }
+}
+
+} // namespace
+
+bool ArchiveReader::isArchive(const QString& path)
+{
+    const auto name = path.toLower();
+    for (const char* suffix: { ".zip", ".tar", ".tar.gz", ".tgz" })
+        if (name.endsWith(suffix))
+            return true;
+    return false;
+}
+
+bool ArchiveReader::read(const QString& path, qint64 treeThreshold, QVector<Member>* members, QString* error)
+{
+    const auto name = path.toLower();
+    if (name.endsWith(".zip"))
+        return readZip(path, treeThreshold, members, error);
+    if (name.endsWith(".tar"))
+        return readTar(path, false, treeThreshold, members, error);
+    if (name.endsWith(".tar.gz") || name.endsWith(".tgz"))
+        return readTar(path, true, treeThreshold, members, error);
+
+    *error = QObject::tr("'%1' is not a supported archive").arg(path);
+    return false;
+}
+
+QString ArchiveReader::memberPath(const QString& archive, const QString& name)
+{
+    // '..' never climbs above the archive root, so a crafted name cannot point to a file outside the archive
+    QStringList parts;
+    for (const auto& part: QString(name).replace('\\', '/').split('/'))
+    {
+        if (part == "..")
+        {
+            if (!parts.isEmpty())
+                parts.removeLast();
+        }
+        else if (!part.isEmpty() && part != ".")
+        {
+            parts.append(part);
+        }
+    }
+
+    if (parts.isEmpty())
+        return {};
+    return archive + mcSeparator + parts.join('/');
+}
+
+bool ArchiveReader::readTar(const QString& path, bool compressed, qint64 treeThreshold, QVector<Member>* members,
+                            QString* error)
+{
+    auto damaged = [&] {
+        *error = QObject::tr("'%1' is damaged or is not a tar archive").arg(path);
+        return false;
+    };
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+    {
+        *error = QObject::tr("Unable to open '%1'").arg(path);
+        return false;
+    }
+
+    quint64 device = 0;
+    ScanFilter::device(path, &device);
+    FileStream fileStream(&file, device);
+    std::unique_ptr<InflateStream> gzip;
+    if (compressed)
+        gzip.reset(new InflateStream(&fileStream, InflateStream::eGzip));
+    Stream* stream = gzip ? static_cast<Stream*>(gzip.get()) : &fileStream;
+
+    QByteArray buffer(cBufferSize, Qt::Uninitialized);
+    char header[cBlock];
+
+    // extended headers describe the next entry
+    QString longName;
+    QString paxPath;
+    qint64 paxSize = -1;
+    qint64 paxTime = -1;
+
+    for (;;)
+    {
+        const qint64 length = stream->read(header, cBlock);
+        if (length == 0)
+            break; // no end-of-archive blocks, but nothing is lost
+        if (length != cBlock)
+            return damaged();
+        if (std::all_of(header, header + cBlock, [](char c) { return c == 0; }))
+            break;
+        if (!isTarHeader(header))
+            return damaged();
+
+        const char type = header[156];
+        QString name = tarString(header, 100);
+        if (memcmp(header + 257, "ustar", 5) == 0 && header[345])
+            name = tarString(header + 345, 155) + '/' + name;
+        qint64 size = tarNumber(header + 124, 12);
+        qint64 time = tarNumber(header + 136, 12);
+
+        if (!longName.isEmpty())
+            name = longName;
+        if (!paxPath.isEmpty())
+            name = paxPath;
+        if (paxSize >= 0)
+            size = paxSize;
+        if (paxTime >= 0)
+            time = paxTime;
+
+        if (size < 0)
+            return damaged();
+        const qint64 padding = (cBlock - size % cBlock) % cBlock;
+
+        if (type == 'L' || type == 'x')
+        {
+            if (size > cMaxExtendedHeader)
+                return damaged();
+
+            QByteArray data(static_cast<int>(size), Qt::Uninitialized);
+            if (stream->read(data.data(), size) != size || !skip(stream, padding, &buffer))
+                return damaged();
+
+            if (type == 'L')
+                longName = QString::fromUtf8(data.constData(), static_cast<int>(qstrnlen(data.constData(), static_cast<uint>(data.size()))));
+            else
+                parsePax(data, &paxPath, &paxSize, &paxTime);
+            continue;
+        }
+
+        longName.clear();
+        paxPath.clear();
+        paxSize = paxTime = -1;
+
+        // directories, links, devices, global pax headers, etc.
+        const bool regular = type == '0' || type == '\0' || type == '7';
+        if (!regular || name.endsWith('/'))
+        {
+            if (!skip(stream, size + padding, &buffer))
+                return damaged();
+            continue;
+        }
+
+        Member member;
+        member.name = name;
+        member.size = size;
+        member.lastModified = QDateTime::fromSecsSinceEpoch(time);
+        if (!hashData(stream, size, treeThreshold, &buffer, &member.hash) || !skip(stream, padding, &buffer))
+            return damaged();
+
+        members->append(member);
+    }
+
+    return true;
+}
+
+bool ArchiveReader::readZip(const QString& path, qint64 treeThreshold, QVector<Member>* members, QString* error)
+{
+    auto damaged = [&] {
+        *error = QObject::tr("'%1' is damaged or is not a zip archive").arg(path);
+        return false;
+    };
+
+    // the central directory and the members are read through different handles,
+    // so the positions of both are kept
+    QFile directory(path);
+    QFile data(path);
+    if (!directory.open(QIODevice::ReadOnly | QIODevice::Unbuffered) || !data.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+    {
+        *error = QObject::tr("Unable to open '%1'").arg(path);
+        return false;
+    }
+
+    // the end of central directory record is followed by a comment up to 64 KiB
+    constexpr int cEndSize = 22;
+    const qint64 size = directory.size();
+    const qint64 tailSize = std::min<qint64>(size, 0xFFFF + cEndSize);
+    if (!directory.seek(size - tailSize))
+        return damaged();
+    const auto tail = directory.read(tailSize);
+    if (tail.size() != tailSize)
+        return damaged();
+
+    int end = -1;
+    for (int i = tail.size() - cEndSize; i >= 0; --i)
+    {
+        if (le32(tail.constData() + i) == 0x06054b50)
+        {
+            end = i;
+            break;
+        }
+    }
+    if (end < 0)
+        return damaged();
+
+    const char* record = tail.constData() + end;
+    quint64 entries = le16(record + 10);
+    qint64 offset = le32(record + 16);
+    if (entries == 0xFFFF || offset == 0xFFFFFFFF)
+    {
+        // zip64: the locator precedes the end record and points to the zip64 end record
+        constexpr int cLocatorSize = 20;
+        constexpr int cEnd64Size = 56;
+        if (end < cLocatorSize || le32(record - cLocatorSize) != 0x07064b50)
+            return damaged();
+
+        char end64[cEnd64Size];
+        if (!directory.seek(static_cast<qint64>(le64(record - cLocatorSize + 8))) ||
+                directory.read(end64, cEnd64Size) != cEnd64Size || le32(end64) != 0x06064b50)
+            return damaged();
+
+        entries = le64(end64 + 32);
+        offset = static_cast<qint64>(le64(end64 + 48));
+    }
+
+    quint64 device = 0;
+    ScanFilter::device(path, &device);
+    FileStream central(&directory, device);
+    FileStream stream(&data, device);
+    if (!central.seek(offset))
+        return damaged();
+
+    QByteArray buffer(cBufferSize, Qt::Uninitialized);
+    int failed = 0; // encrypted, damaged or compressed with an unsupported method
+
+    for (quint64 i = 0; i < entries; ++i)
+    {
+        constexpr int cHeaderSize = 46;
+        char header[cHeaderSize];
+        if (central.read(header, cHeaderSize) != cHeaderSize || le32(header) != 0x02014b50)
+            return damaged();
+
+        const quint16 flags = le16(header + 8);
+        const quint16 method = le16(header + 10);
+        const quint16 time = le16(header + 12);
+        const quint16 date = le16(header + 14);
+        const quint32 expectedCrc = le32(header + 16);
+        qint64 compressedSize = le32(header + 20);
+        qint64 uncompressedSize = le32(header + 24);
+        const int nameLength = le16(header + 28);
+        const int extraLength = le16(header + 30);
+        const int commentLength = le16(header + 32);
+        qint64 localOffset = le32(header + 42);
+
+        QByteArray name(nameLength, Qt::Uninitialized);
+        QByteArray extra(extraLength, Qt::Uninitialized);
+        if (central.read(name.data(), nameLength) != nameLength ||
+                central.read(extra.data(), extraLength) != extraLength ||
+                !skip(&central, commentLength, &buffer))
+            return damaged();
+
+        QDateTime lastModified(QDate(1980 + (date >> 9), (date >> 5) & 0x0F, date & 0x1F),
+                               QTime(time >> 11, (time >> 5) & 0x3F, (time & 0x1F) * 2));
+
+        // zip64 sizes and offset are present only for the fields which do not fit in 32 bits
+        for (int position = 0; position + 4 <= extra.size();)
+        {
+            const quint16 id = le16(extra.constData() + position);
+            const int length = le16(extra.constData() + position + 2);
+            const char* field = extra.constData() + position + 4;
+            if (position + 4 + length > extra.size())
+                break;
+
+            if (id == 0x0001)
+            {
+                int k = 0;
+                auto next = [&](qint64* value) {
+                    if (*value == 0xFFFFFFFF && k + 8 <= length)
+                    {
+                        *value = static_cast<qint64>(le64(field + k));
+                        k += 8;
+                    }
+                };
+                next(&uncompressedSize);
+                next(&compressedSize);
+                next(&localOffset);
+            }
+            else if (id == 0x5455 && length >= 5 && (field[0] & 1)) // extended timestamp
+            {
+                lastModified = QDateTime::fromSecsSinceEpoch(static_cast<qint32>(le32(field + 1)));
+            }
+
+            position += 4 + length;
+        }
+
+        const auto memberName = flags & 0x0800 ? QString::fromUtf8(name) : QString::fromLatin1(name);
+        if (memberName.endsWith('/'))
+            continue; // directory
+
+        if ((flags & 0x0001) || (method != 0 && method != 8))
+        {
+            ++failed;
+            continue;
+        }
+
+        // the local header may have extra fields different from the central ones
+        constexpr int cLocalSize = 30;
+        char local[cLocalSize];
+        if (!stream.seek(localOffset) || stream.read(local, cLocalSize) != cLocalSize || le32(local) != 0x04034b50 ||
+                !skip(&stream, le16(local + 26) + le16(local + 28), &buffer))
+        {
+            ++failed;
+            continue;
+        }
+
+        Member member;
+        member.name = memberName;
+        member.size = uncompressedSize;
+        member.lastModified = lastModified;
+
+        LimitedStream compressed(&stream, compressedSize);
+        bool ok = false;
+        quint32 crc = 0;
+        if (method == 0)
+        {
+            ok = hashData(&compressed, uncompressedSize, treeThreshold, &buffer, &member.hash, &crc);
+        }
+        else
+        {
+            InflateStream inflater(&compressed, InflateStream::eRaw);
+            ok = hashData(&inflater, uncompressedSize, treeThreshold, &buffer, &member.hash, &crc);
+        }
+
+        // a damaged member would get a wrong hash and look unique, or match a wrong copy
+        if (ok && crc == expectedCrc)
+            members->append(member);
+        else
+            ++failed;
+    }
+
+    if (failed > 0)
+    {
+        *error = QObject::tr("Cannot read %n member(s) of '%1': encrypted, damaged or compressed with an unsupported method", "", failed).arg(path);
+        return false;
+    }
+
+    return true;
+}
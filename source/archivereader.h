@@ -0,0 +1,44 @@
+#ifndef ARCHIVEREADER_H
+#define ARCHIVEREADER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QString>
+#include <QVector>
+
+/// Hashes the members of zip and tar (plain or gzip) archives without extracting them
+/// Archives are streamed through fixed-size buffers, so the memory usage does not depend
+/// on the archive size; members are hashed the same way as loose files: SHA-1, or TreeHash
+/// from the tree hash threshold on
+class ArchiveReader
+{
+public:
+    struct Member
+    {
+        QString name; ///< The path inside the archive
+        qint64 size = 0;
+        QDateTime lastModified;
+        QByteArray hash;
+    };
+
+    /// Recognized by the file name suffix
+    static bool isArchive(const QString& path);
+
+    /// Hash all the regular file members; thread-safe
+    /// Members of treeThreshold bytes or larger get a tree hash, see ScanOptions::treeHashThreshold
+    /// Returns false and sets the localized error if some members cannot be read, the others are kept
+    static bool read(const QString& path, qint64 treeThreshold, QVector<Member>* members, QString* error);
+
+    /// Members are shown as 'archive!/inner/path'; '.' and '..' are resolved within the archive
+    /// Returns an empty string if nothing is left of the name, e.g. for '../..'
+    static QString memberPath(const QString& archive, const QString& name);
+
+    static const char* const mcSeparator;
+
+private:
+    static bool readTar(const QString& path, bool compressed, qint64 treeThreshold, QVector<Member>* members,
+                        QString* error);
+    static bool readZip(const QString& path, qint64 treeThreshold, QVector<Member>* members, QString* error);
+};
+
+#endif // ARCHIVEREADER_H
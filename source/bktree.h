@@ -0,0 +1,72 @@
+#ifndef BKTREE_H
+#define BKTREE_H
+
+#include <map>
+#include <vector>
+
+#include "imagehash.h"
+
+/// Burkhard-Keller tree: metric tree of 64-bit perceptual hashes with Hamming distance
+/// Finds all hashes within the given distance without comparing with each stored hash
+class BKTree
+{
+public:
+    void insert(quint64 hash, int value)
+    {
+        if (mNodes.empty())
+        {
+            mNodes.push_back({ hash, value, {} });
+            return;
+        }
+
+        size_t node = 0;
+        for (;;)
+        {
+            const int d = ImageHash::distance(hash, mNodes[node].hash);
+            auto child = mNodes[node].children.find(d);
+            if (child == mNodes[node].children.end())
+            {
+                mNodes[node].children.emplace(d, mNodes.size());
+                mNodes.push_back({ hash, value, {} });
+                return;
+            }
+            node = child->second;
+        }
+    }
+
+    /// Calls f(value) for each inserted hash within maxDistance from the given hash
+    template <class F>
+    void find(quint64 hash, int maxDistance, F f) const
+    {
+        if (mNodes.empty())
+            return;
+
+        std::vector<size_t> stack = { 0 };
+        while (!stack.empty())
+        {
+            const auto& node = mNodes[stack.back()];
+            stack.pop_back();
+
+            const int d = ImageHash::distance(hash, node.hash);
+            if (d <= maxDistance)
+                f(node.value);
+
+            // triangle inequality: only subtrees in [d - maxDistance, d + maxDistance] can match
+            for (auto child = node.children.lower_bound(d - maxDistance);
+                 child != node.children.end() && child->first <= d + maxDistance; ++child)
+                stack.push_back(child->second);
+        }
+    }
+
+private:
+    struct Node
+    {
+        quint64 hash;
+        int value;
+        std::map<int, size_t> children; ///< distance --> node index
+    };
+
+    std::vector<Node> mNodes;
+};
+
+#endif // BKTREE_H
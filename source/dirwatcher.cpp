@@ -0,0 +1,294 @@
+#include "dirwatcher.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QFutureWatcher>
+#include <QSocketNotifier>
+#include <QtConcurrent>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+/// The top directory and its subdirectories accepted by the filter; runs in a worker thread
+QStringList acceptedDirs(const QString& root, const QString& top, const ScanFilter& filter)
+{
+    const auto prefix = root.endsWith('/') ? root : root + '/';
+    if (top != root && !filter.acceptsDir(top.mid(prefix.size())))
+        return {};
+
+    // a manual stack instead of QDirIterator::Subdirectories, so excluded subtrees are skipped as a whole
+    QStringList accepted;
+    QStringList dirs = { top };
+    while (!dirs.isEmpty())
+    {
+        const auto dir = dirs.takeLast();
+        accepted.append(dir);
+
+        QDirIterator subdirs(dir, QDir::Dirs | QDir::Hidden | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+        while (subdirs.hasNext())
+        {
+            const auto subdir = subdirs.next();
+            if (filter.acceptsDir(subdir.mid(prefix.size())))
+                dirs.append(subdir);
+        }
+    }
+    return accepted;
+}
+
+} // namespace
+
+DirWatcher::DirWatcher(QObject* parent) :
+    QObject(parent)
+{
+    mDebounce.setSingleShot(true);
+    mDebounce.setInterval(mcDebounce);
+    connect(&mDebounce, &QTimer::timeout, this, &DirWatcher::flush);
+
+#ifdef Q_OS_LINUX
+    mInotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (mInotify < 0)
+    {
+        qWarning() << "inotify_init1 failed:" << qt_error_string(errno);
+        return;
+    }
+
+    mNotifier = new QSocketNotifier(mInotify, QSocketNotifier::Read, this);
+    // string-based connection: the signal is overloaded since Qt 5.15
+    connect(mNotifier, SIGNAL(activated(int)), this, SLOT(readEvents()));
+#else
+    mWatcher = new QFileSystemWatcher(this);
+    connect(mWatcher, &QFileSystemWatcher::directoryChanged, this, &DirWatcher::onDirectoryChanged);
+#endif
+}
+
+DirWatcher::~DirWatcher()
+{
+#ifdef Q_OS_LINUX
+    if (mInotify >= 0)
+        ::close(mInotify);
+#endif
+}
+
+void DirWatcher::addTree(const QString& root)
+{
+    const auto path = QDir(root).absolutePath();
+    if (!mRoots.contains(path))
+        mRoots.append(path);
+
+    watchTree(path, path, false);
+}
+
+void DirWatcher::clear()
+{
+    mDebounce.stop();
+    mPending.clear();
+    mRoots.clear();
+    ++mGeneration;
+
+#ifdef Q_OS_LINUX
+    for (auto wd = mDirs.cbegin(); wd != mDirs.cend(); ++wd)
+        inotify_rm_watch(mInotify, wd.key());
+    mDirs.clear();
+    mWatches.clear();
+#else
+    if (!mWatcher->directories().isEmpty())
+        mWatcher->removePaths(mWatcher->directories());
+#endif
+}
+
+void DirWatcher::watchTree(const QString& root, const QString& top, bool notifyDirs)
+{
+    auto walk = new QFutureWatcher<QStringList>(this);
+    connect(walk, &QFutureWatcher<QStringList>::finished, this, [this, walk, notifyDirs, generation = mGeneration] {
+        walk->deleteLater();
+        if (generation != mGeneration)
+            return; // cleared during the walk
+
+        for (const auto& dir: walk->result())
+        {
+            addDir(dir);
+            if (notifyDirs)
+                notify(dir);
+        }
+    });
+    walk->setFuture(QtConcurrent::run(acceptedDirs, root, top, mFilter));
+}
+
+QString DirWatcher::rootOf(const QString& path) const
+{
+    for (const auto& root: mRoots)
+        if (path == root || path.startsWith(root.endsWith('/') ? root : root + '/'))
+            return root;
+    return QString();
+}
+
+void DirWatcher::addDir(const QString& dir)
+{
+    const auto path = QDir(dir).absolutePath();
+
+#ifdef Q_OS_LINUX
+    if (mInotify < 0 || mWatches.contains(path))
+        return;
+
+    // IN_CLOSE_WRITE instead of IN_MODIFY: a file being written is reported once, when it is complete
+    const int wd = inotify_add_watch(mInotify, QFile::encodeName(path).constData(),
+                                     IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                                     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR);
+    if (wd < 0)
+    {
+        static bool warned = false; // ENOSPC means fs.inotify.max_user_watches is too small
+        if (!warned)
+            qWarning() << "Unable to watch" << path << ":" << qt_error_string(errno);
+        warned = true;
+        return;
+    }
+
+    mDirs.insert(wd, path);
+    mWatches.insert(path, wd);
+#else
+    if (!mWatcher->directories().contains(path))
+        mWatcher->addPath(path);
+#endif
+}
+
+void DirWatcher::removeTree(const QString& root)
+{
+    const auto prefix = root + '/';
+
+#ifdef Q_OS_LINUX
+    for (auto watch = mWatches.begin(); watch != mWatches.end(); )
+    {
+        if (watch.key() == root || watch.key().startsWith(prefix))
+        {
+            inotify_rm_watch(mInotify, watch.value());
+            mDirs.remove(watch.value());
+            watch = mWatches.erase(watch);
+        }
+        else
+        {
+            ++watch;
+        }
+    }
+#else
+    QStringList removed;
+    for (const auto& dir: mWatcher->directories())
+        if (dir == root || dir.startsWith(prefix))
+            removed.append(dir);
+    if (!removed.isEmpty())
+        mWatcher->removePaths(removed);
+#endif
+}
+
+void DirWatcher::notify(const QString& path)
+{
+    mPending.insert(path);
+    mDebounce.start(); // restart
+}
+
+void DirWatcher::flush()
+{
+    if (mPending.isEmpty())
+        return;
+
+    const QStringList paths = mPending.values();
+    mPending.clear();
+    emit changed(paths);
+}
+
+#ifdef Q_OS_LINUX
+void DirWatcher::readEvents()
+{
+    alignas(inotify_event) char buffer[16 * 1024];
+
+    for (;;)
+    {
+        const ssize_t length = ::read(mInotify, buffer, sizeof(buffer));
+        if (length <= 0)
+            break;
+
+        for (const char* p = buffer; p < buffer + length; )
+        {
+            const auto event = reinterpret_cast<const inotify_event*>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // some events are lost, so everything should be checked
+                for (const auto& dir: qAsConst(mDirs))
+                    notify(dir);
+                continue;
+            }
+
+            const auto dir = mDirs.value(event->wd);
+            if (dir.isEmpty())
+                continue;
+
+            if (event->mask & IN_IGNORED)
+            {
+                mWatches.remove(mDirs.take(event->wd));
+                continue;
+            }
+
+            const auto path = event->len ? dir + '/' + QFile::decodeName(event->name) : dir;
+            const bool isDir = event->mask & IN_ISDIR;
+
+            if (isDir && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+            {
+                const auto root = rootOf(path);
+                if (!root.isEmpty())
+                    watchTree(root, path, true);
+            }
+            else if (isDir && (event->mask & (IN_DELETE | IN_MOVED_FROM)))
+            {
+                removeTree(path);
+            }
+            else if (!isDir && (event->mask & IN_CREATE))
+            {
+                continue; // the file is empty yet, wait for IN_CLOSE_WRITE
+            }
+
+            notify(path);
+        }
+    }
+}
+#else
+void DirWatcher::readEvents()
+{
+}
+
+void DirWatcher::onDirectoryChanged(const QString& dir)
+{
+    if (!QFileInfo::exists(dir))
+    {
+        removeTree(dir);
+        notify(dir);
+        return;
+    }
+
+    // new subdirectories should be watched too
+    QDirIterator subdirs(dir, QDir::Dirs | QDir::Hidden | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+    while (subdirs.hasNext())
+    {
+        const auto subdir = subdirs.next();
+        if (mWatcher->directories().contains(subdir))
+            continue;
+
+        const auto root = rootOf(subdir);
+        if (!root.isEmpty())
+            watchTree(root, subdir, true);
+        notify(subdir);
+    }
+
+    notify(dir);
+}
+#endif
@@ -0,0 +1,75 @@
+#ifndef DIRWATCHER_H
+#define DIRWATCHER_H
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+
+#include "scanfilter.h"
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+
+/// Watches directory trees and reports changed paths in batches
+/// Uses inotify on Linux (so modified files are reported after they are closed),
+/// QFileSystemWatcher elsewhere (only directory changes are reported)
+class DirWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DirWatcher(QObject* parent = nullptr);
+    ~DirWatcher() override;
+
+    /// Watch the directory and all its subdirectories except the excluded ones
+    /// The tree is walked in a background thread, the watches are added when the walk is done
+    void addTree(const QString& root);
+
+    /// Stop watching all directories
+    void clear();
+
+    /// Directories excluded by the filter are not watched; applies to the trees added afterwards
+    void setFilter(const ScanFilter& filter) { mFilter = filter; }
+
+    /// Paths are collected until there are no events during this interval
+    static const int mcDebounce = 500;
+
+signals:
+    /// Created, modified or removed files and directories
+    /// Directory means 'something in the directory was changed'
+    void changed(const QStringList& paths);
+
+private slots:
+    /// Read pending inotify events; unused on other platforms
+    void readEvents();
+
+private:
+    /// Walk the subtree top of the root in a background thread, then watch the accepted directories
+    void watchTree(const QString& root, const QString& top, bool notifyDirs);
+    /// The root added with addTree which contains the path, empty if none
+    QString rootOf(const QString& path) const;
+    void addDir(const QString& dir);
+    void removeTree(const QString& root);
+    void notify(const QString& path);
+    void flush();
+
+    QTimer mDebounce;
+    QSet<QString> mPending; ///< Paths changed since the last flush
+    ScanFilter mFilter;
+    QStringList mRoots; ///< Added with addTree, the filter patterns are relative to them
+    int mGeneration = 0; ///< Incremented by clear, so the walks started before are ignored
+
+#ifdef Q_OS_LINUX
+    int mInotify = -1;
+    QSocketNotifier* mNotifier = nullptr;
+    QHash<int, QString> mDirs; ///< Watch descriptor --> directory
+    QHash<QString, int> mWatches; ///< Directory --> watch descriptor
+#else
+    void onDirectoryChanged(const QString& dir);
+
+    QFileSystemWatcher* mWatcher = nullptr;
+#endif
+};
+
+#endif // DIRWATCHER_H
@@ -0,0 +1,214 @@
+#include "externalsort.h"
+
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QObject>
+#include <QSaveFile>
+
+namespace {
+
+constexpr qint64 cRecordOverhead = 64; ///< Bytes of the allocations and the container per record
+
+qint64 recordMemory(const ExternalSort::Record& record)
+{
+    return static_cast<qint64>(sizeof(record)) + cRecordOverhead + record.hash.size() + record.path.size() * 2;
+}
+
+QDataStream& operator <<(QDataStream& out, const ExternalSort::Record& record)
+{
+    return out << record.size << record.lastModified << record.hash << record.path;
+}
+
+QDataStream& operator >>(QDataStream& in, ExternalSort::Record& record)
+{
+    return in >> record.size >> record.lastModified >> record.hash >> record.path;
+}
+
+/// A spilled file being merged
+struct Run
+{
+    QFile file;
+    QDataStream in;
+    ExternalSort::Record record; ///< The smallest record not merged yet
+};
+
+/// Read the next record; false at the end of the run or on error
+bool next(Run* run)
+{
+    if (run->in.atEnd())
+        return false;
+
+    run->in >> run->record;
+    return run->in.status() == QDataStream::Ok;
+}
+
+} // namespace
+
+bool ExternalSort::Record::operator <(const Record& other) const
+{
+    if (size != other.size)
+        return size < other.size;
+    if (hash != other.hash)
+        return hash < other.hash;
+    return path < other.path;
+}
+
+ExternalSort::ExternalSort(qint64 budget) :
+    mBudget(budget),
+    mDir(QDir::tempPath() + "/multidiff-XXXXXX")
+{
+    if (!mDir.isValid())
+        mErrorString = QObject::tr("Unable to create a temporary directory: %1").arg(mDir.errorString());
+}
+
+bool ExternalSort::append(const Record& record)
+{
+    if (!mErrorString.isEmpty())
+        return false;
+
+    mUsed += recordMemory(record);
+    mRecords.append(record);
+
+    return mUsed < mBudget || spill();
+}
+
+bool ExternalSort::spill()
+{
+    std::sort(mRecords.begin(), mRecords.end());
+
+    const bool ok = writeRun([this](QDataStream& out) {
+        for (const auto& record: qAsConst(mRecords))
+            out << record;
+        return true;
+    });
+    if (!ok)
+        return false;
+
+    mRecords.clear();
+    mRecords.squeeze();
+    mUsed = 0;
+    return true;
+}
+
+bool ExternalSort::writeRun(const std::function<bool(QDataStream&)>& write)
+{
+    QSaveFile file(mDir.filePath(QString("run-%1").arg(mWritten++)));
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        mErrorString = QObject::tr("Unable to write '%1': %2").arg(file.fileName(), file.errorString());
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_6);
+    if (!write(out))
+        return false;
+
+    if (out.status() != QDataStream::Ok || !file.commit())
+    {
+        mErrorString = QObject::tr("Unable to write '%1': %2").arg(file.fileName(), file.errorString());
+        return false;
+    }
+
+    mRuns.append(file.fileName());
+    return true;
+}
+
+bool ExternalSort::merge(const std::function<bool(const Record&)>& consumer)
+{
+    if (!mErrorString.isEmpty())
+        return false;
+
+    // everything fits in memory, no files
+    if (mRuns.isEmpty())
+    {
+        std::sort(mRecords.begin(), mRecords.end());
+        for (const auto& record: qAsConst(mRecords))
+            if (!consumer(record))
+                break;
+
+        mRecords.clear();
+        mUsed = 0;
+        return true;
+    }
+
+    if (!mRecords.isEmpty() && !spill())
+        return false;
+
+    // the oldest runs are merged into a longer one until the rest can be open at once,
+    // so the number of open files and read buffers stays bounded
+    bool ok = true;
+    while (ok && mRuns.size() > mcMaxFanIn)
+    {
+        const auto inputs = mRuns.mid(0, mcMaxFanIn);
+        mRuns.erase(mRuns.begin(), mRuns.begin() + mcMaxFanIn);
+
+        ok = writeRun([&](QDataStream& out) {
+            return mergeRuns(inputs, [&out](const Record& record) {
+                out << record;
+                return out.status() == QDataStream::Ok;
+            });
+        });
+
+        for (const auto& path: inputs)
+            QFile::remove(path);
+    }
+
+    ok = ok && mergeRuns(mRuns, consumer);
+
+    for (const auto& path: qAsConst(mRuns))
+        QFile::remove(path);
+    mRuns.clear();
+
+    return ok;
+}
+
+bool ExternalSort::mergeRuns(const QStringList& paths, const std::function<bool(const Record&)>& consumer)
+{
+    std::vector<std::unique_ptr<Run>> runs;
+    for (const auto& path: paths)
+    {
+        runs.emplace_back(new Run);
+        auto& run = *runs.back();
+        run.file.setFileName(path);
+        if (!run.file.open(QIODevice::ReadOnly))
+        {
+            mErrorString = QObject::tr("Unable to read '%1': %2").arg(path, run.file.errorString());
+            return false;
+        }
+        run.in.setDevice(&run.file);
+        run.in.setVersion(QDataStream::Qt_5_6);
+    }
+
+    // the run with the smallest current record on top
+    auto greater = [&runs](size_t lhs, size_t rhs) { return runs[rhs]->record < runs[lhs]->record; };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+    for (size_t i = 0; i < runs.size(); ++i)
+        if (next(runs[i].get()))
+            heap.push(i);
+
+    while (!heap.empty())
+    {
+        const auto i = heap.top();
+        heap.pop();
+
+        if (!consumer(runs[i]->record))
+            break;
+
+        if (next(runs[i].get()))
+            heap.push(i);
+        else if (runs[i]->in.status() != QDataStream::Ok)
+        {
+            mErrorString = QObject::tr("Unable to read '%1'").arg(runs[i]->file.fileName());
+            return false;
+        }
+    }
+
+    return true;
+}
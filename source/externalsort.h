@@ -0,0 +1,67 @@
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+#include <functional>
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QVector>
+
+/// Sorts file records which may not fit in memory
+/// Records are accumulated up to the memory budget, then sorted and spilled to a run file in the
+/// temporary directory; the runs are combined by a k-way merge, reading one record of each run at a time
+/// At most mcMaxFanIn runs are merged at once, more runs are first merged into intermediate ones
+class ExternalSort
+{
+public:
+    struct Record
+    {
+        qint64 size = 0;
+        qint64 lastModified = 0; ///< ms since epoch
+        QByteArray hash;
+        QString path;
+
+        /// By size, then by hash, then by path
+        bool operator <(const Record& other) const;
+    };
+
+    /// The records kept in memory take about budget bytes at most
+    explicit ExternalSort(qint64 budget);
+
+    /// Returns false and sets errorString if the records could not be spilled;
+    /// nothing is appended after a failure
+    bool append(const Record& record);
+
+    /// Pass all the records in order to the consumer, which returns false to stop; the sorter is empty afterwards
+    /// Returns false and sets errorString on a read or write error
+    bool merge(const std::function<bool(const Record&)>& consumer);
+
+    /// The number of run files written so far
+    int runs() const { return mWritten; }
+
+    QString errorString() const { return mErrorString; }
+
+    static const int mcMaxFanIn = 64; ///< Runs open at once while merging
+
+private:
+    /// Sort the records in memory and write them to a new run file
+    bool spill();
+
+    /// Write a new run file by the given function, which returns false on error
+    bool writeRun(const std::function<bool(QDataStream&)>& write);
+
+    /// k-way merge of the given run files; the files are kept
+    bool mergeRuns(const QStringList& paths, const std::function<bool(const Record&)>& consumer);
+
+    const qint64 mBudget;
+    QTemporaryDir mDir;
+    QVector<Record> mRecords;
+    qint64 mUsed = 0; ///< The approximate memory taken by mRecords
+    QStringList mRuns; ///< Paths of the sorted run files
+    int mWritten = 0; ///< Run files written, names the next one
+    QString mErrorString;
+};
+
+#endif // EXTERNALSORT_H
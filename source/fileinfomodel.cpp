@@ -1,6 +1,10 @@
 #include "fileinfomodel.h"
 
+#include <algorithm>
+#include <atomic>
+#include <numeric>
 #include <set>
+#include <utility>
 
 #include <QCryptographicHash>
 #include <QDateTime>
@@ -11,20 +15,41 @@
 #include <QMessageBox>
 #include <QPainter>
 #include <QRandomGenerator>
+#include <QSet>
+#include <QThread>
+#include <QThreadPool>
 #include <QUrl>
+#include <QtConcurrent>
 
+#include "archivereader.h"
+#include "bktree.h"
+#include "externalsort.h"
+#include "imagehash.h"
+#include "ioscheduler.h"
+#include "profiler.h"
+#include "progress.h"
+#include "referencecache.h"
+#include "shardedscan.h"
+#include "sparsefile.h"
 #include "statusmessage.h"
+#include "throttle.h"
+#include "treehash.h"
 
-bool operator ==(const FileItem& lhs, const FileItem& rhs) {
-    return lhs.fileInfo == rhs.fileInfo;
-}
-
-void FileInfoModel::add(const QList<FileItem>& items)
+void FileInfoModel::add(const QList<FileItem>& items, const CollapsedDirs& collapsed)
 {
+    Profiler::Scope scope(Profiler::eModel);
     beginResetModel();
     for (const auto& i : items)
-        if (!mData.contains(i))
-            mData.append(i);
+    {
+        const auto path = i.fileInfo.absoluteFilePath();
+        if (mRows.contains(path))
+            continue;
+        mRows.insert(path, mData.size());
+        mData.append(i);
+    }
+    for (auto i = collapsed.cbegin(); i != collapsed.cend(); ++i)
+        mCollapsed.insert(i.key(), i.value());
+    updateSimilarGroups();
     updatePixmaps();
     endResetModel();
 }
@@ -34,8 +59,182 @@ void FileInfoModel::remove(std::set<int, std::greater<int>>& rows)
     beginResetModel();
 
     for (int i: rows)
+    {
+        if (mData[i].isDir)
+            mCollapsed.remove(mData[i].fileInfo.absoluteFilePath());
         mData.removeAt(i);
+    }
+
+    updateRows();
+    endResetModel();
+}
+
+void FileInfoModel::clear()
+{
+    beginResetModel();
+    mData.clear();
+    mRows.clear();
+    mCollapsed.clear();
+    endResetModel();
+}
+
+void FileInfoModel::expand(std::set<int, std::greater<int>>& rows)
+{
+    beginResetModel();
+
+    QList<FileItem> files;
+    for (int i: rows)
+    {
+        if (!mData[i].isDir)
+            continue;
+
+        files.append(mCollapsed.take(mData[i].fileInfo.absoluteFilePath()));
+        mData.removeAt(i);
+    }
+    updateRows();
+
+    for (const auto& file: files)
+    {
+        const auto path = file.fileInfo.absoluteFilePath();
+        if (mRows.contains(path))
+            continue;
+        mRows.insert(path, mData.size());
+        mData.append(file);
+    }
+
+    updateSimilarGroups();
+    updatePixmaps();
+    endResetModel();
+}
+
+void FileInfoModel::expand(const QString& dir)
+{
+    const int r = row(dir);
+    if (r < 0 || !mData[r].isDir)
+        return;
+
+    // the copies were collapsed only because they are identical to this one
+    std::set<int, std::greater<int>> rows;
+    for (int i = 0; i < mData.size(); ++i)
+        if (mData[i].isDir && mData[i].hash == mData[r].hash)
+            rows.insert(i);
+    expand(rows);
+}
+
+void FileInfoModel::update(const QList<FileItem>& items)
+{
+    Profiler::Scope scope(Profiler::eModel);
+    QList<FileItem> added;
+    bool images = false; // similar groups should be recalculated
+
+    for (const auto& item: items)
+    {
+        const int r = row(item.fileInfo.absoluteFilePath());
+        if (r < 0)
+        {
+            added.append(item);
+            continue;
+        }
+
+        images = images || item.isImage || mData[r].isImage;
+        mData[r] = item;
+        updatePixmap(mData[r]);
+        emit dataChanged(index(r, 0), index(r, ColCount - 1));
+    }
+
+    if (!added.isEmpty())
+    {
+        beginInsertRows({}, mData.size(), mData.size() + added.size() - 1);
+        for (const auto& item: added)
+        {
+            images = images || item.isImage;
+            mRows.insert(item.fileInfo.absoluteFilePath(), mData.size());
+            mData.append(item);
+            updatePixmap(mData.last());
+        }
+        endInsertRows();
+    }
 
+    if (images && !mData.isEmpty())
+    {
+        updateSimilarGroups();
+        updateSimilarPixmaps();
+        emit dataChanged(index(0, eSimilar), index(mData.size() - 1, eSimilar));
+    }
+}
+
+void FileInfoModel::remove(const QStringList& paths)
+{
+    QSet<QString> files;
+    QStringList dirs; // directories and archives
+    for (const auto& path: paths)
+    {
+        files.insert(path);
+        dirs.append(path + '/');
+        dirs.append(path + ArchiveReader::mcSeparator);
+    }
+
+    auto isRemoved = [&](const FileItem& item) {
+        const auto path = item.fileInfo.absoluteFilePath();
+        return files.contains(path) ||
+                std::any_of(dirs.cbegin(), dirs.cend(), [&path](const QString& dir) { return path.startsWith(dir); });
+    };
+
+    bool removed = false;
+    for (int r = mData.size() - 1; r >= 0; --r)
+    {
+        if (!isRemoved(mData[r]))
+            continue;
+
+        beginRemoveRows({}, r, r);
+        if (mData[r].isDir)
+            mCollapsed.remove(mData[r].fileInfo.absoluteFilePath());
+        mData.removeAt(r);
+        endRemoveRows();
+        removed = true;
+    }
+
+    for (const auto& dir: paths)
+        mCollapsed.remove(dir);
+
+    if (removed)
+        updateRows();
+}
+
+QStringList FileInfoModel::files(const QString& dir) const
+{
+    QStringList paths;
+    for (const auto& item: mData)
+        if (!item.isDir && item.fileInfo.absolutePath() == dir)
+            paths.append(item.fileInfo.absoluteFilePath());
+    return paths;
+}
+
+QString FileInfoModel::collapsedDir(const QString& path) const
+{
+    for (auto dir = mCollapsed.cbegin(); dir != mCollapsed.cend(); ++dir)
+        if (path == dir.key() || path.startsWith(dir.key() + '/'))
+            return dir.key();
+    return {};
+}
+
+void FileInfoModel::updateRows()
+{
+    mRows.clear();
+    mRows.reserve(mData.size());
+    for (int r = 0; r < mData.size(); ++r)
+        mRows.insert(mData[r].fileInfo.absoluteFilePath(), r);
+}
+
+void FileInfoModel::setImageDistance(int distance)
+{
+    if (distance == mImageDistance)
+        return;
+
+    beginResetModel();
+    mImageDistance = distance;
+    updateSimilarGroups();
+    updatePixmaps();
     endResetModel();
 }
 
@@ -51,6 +250,7 @@ QVariant FileInfoModel::headerData(int section, Qt::Orientation orientation, int
         case eSize:         return tr("Size");
         case eLastModified: return tr("Last modified");
         case eHash:         return tr("Hash");
+        case eSimilar:      return tr("Similar");
         default:            return {};
     }
 }
@@ -82,6 +282,9 @@ QVariant FileInfoModel::data(const QModelIndex& index, int role) const
     if (role == Qt::DecorationRole && index.column() == 0)
         return mData[index.row()].pixmap;
 
+    if (role == Qt::DecorationRole && index.column() == eSimilar && mData[index.row()].similarGroup)
+        return mData[index.row()].similarPixmap;
+
     return {};
 }
 
@@ -95,50 +298,119 @@ FileItem FileInfoModel::item(int row) const
 
 QVariant FileInfoModel::displayData(const QModelIndex& index) const
 {
-    const auto& file = mData[index.row()].fileInfo;
+    const auto& item = mData[index.row()];
+    const auto& file = item.fileInfo;
     switch (index.column())
     {
-        case eName:         return file.fileName();
+        case eName:         return item.isDir ? file.fileName() + '/' : file.fileName();
         case eDir:          return file.dir().absolutePath();
-        case eSize:         return file.size();
-        case eLastModified: return file.lastModified();
+        case eSize:         return item.size;
+        case eLastModified: return item.lastModified;
         case eHash:         return mData[index.row()].hash;
+        case eSimilar:      return mData[index.row()].similarGroup ? mData[index.row()].similarGroup : QVariant();
         default:            return {};
     }
 }
 
+QColor FileInfoModel::ColorGenerator::next()
+{
+    if (mColor < Qt::transparent)
+        return static_cast<Qt::GlobalColor>(mColor++);
+
+    return { mRand.bounded(255), mRand.bounded(255), mRand.bounded(255) };
+}
+
 void FileInfoModel::updatePixmaps()
 {
-    class ColorGenerator
+    QSet<QByteArray> unique;
+
+    for (auto& item: mData)
     {
-    public:
-        QColor next() {
-            if (mColor < Qt::transparent)
-                return static_cast<Qt::GlobalColor>(mColor++);
+        updatePixmap(item);
+        unique.insert(item.hash);
+    }
 
-            return { mRand.bounded(255), mRand.bounded(255), mRand.bounded(255) };
-        }
+    updateSimilarPixmaps();
 
-    private:
-        int mColor = Qt::lightGray; // darkGray, gray and lightGray looks like the same color in the list, so we start from lightGray
-        QRandomGenerator mRand;
-    };
+    StatusMessage::show(QObject::tr("There are %n/%1 unique file(s)", "", unique.size()).arg(mData.size()), StatusMessage::mcInfinite);
+}
+
+void FileInfoModel::updatePixmap(FileItem& item)
+{
+    // it is already known hash or a brand new one?
 
-    ColorGenerator uniqueColors;
-    QMap<QByteArray, QColor> colors; // each hash have unique color
+    // the rows of one hash share the pixmap, it is painted once
+    auto ipixmap = mColors.find(item.hash);
+    if (ipixmap == mColors.end())
+        ipixmap = mColors.insert(item.hash, coloredSquarePixmap(mHashColors.next()));
+
+    item.pixmap = *ipixmap;
+}
+
+void FileInfoModel::updateSimilarPixmaps()
+{
+    ColorGenerator similarColors;
+    QMap<int, QPixmap> groupPixmaps; // each group of similar images have unique color
 
     for (auto& item: mData)
     {
-        // it is already known hash or a brand new one?
+        if (!item.similarGroup)
+            continue;
+
+        auto igroup = groupPixmaps.find(item.similarGroup);
+        if (igroup == groupPixmaps.end())
+            igroup = groupPixmaps.insert(item.similarGroup, coloredSquarePixmap(similarColors.next()));
+
+        item.similarPixmap = *igroup;
+    }
+}
 
-        auto icolor = colors.find(item.hash);
-        if (icolor == colors.cend())
-            icolor = colors.insert(item.hash, uniqueColors.next());
+void FileInfoModel::updateSimilarGroups()
+{
+    // images are clustered with union-find: each pair closer than mImageDistance
+    // joins their clusters, so similarity is transitive within a group
 
-        item.pixmap = coloredSquarePixmap(*icolor);
+    QVector<int> images; // rows with perceptual hash
+    for (int row = 0; row < mData.size(); ++row)
+    {
+        mData[row].similarGroup = 0;
+        if (mData[row].isImage)
+            images.append(row);
     }
 
-    StatusMessage::show(QObject::tr("There are %n/%1 unique file(s)", "", colors.size()).arg(mData.size()), StatusMessage::mcInfinite);
+    std::vector<int> parent(images.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto root = [&parent](int i) {
+        while (parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    };
+
+    BKTree tree;
+    for (int i = 0; i < images.size(); ++i)
+    {
+        const auto hash = mData[images[i]].imageHash;
+        tree.find(hash, mImageDistance, [&](int j) { parent[root(i)] = root(j); });
+        tree.insert(hash, i);
+    }
+
+    std::vector<int> groupSize(images.size(), 0);
+    for (int i = 0; i < images.size(); ++i)
+        ++groupSize[root(i)];
+
+    QMap<int, int> groups; // root --> group number
+    for (int i = 0; i < images.size(); ++i)
+    {
+        const int r = root(i);
+        if (groupSize[r] < 2)
+            continue;
+
+        auto igroup = groups.find(r);
+        if (igroup == groups.end())
+            igroup = groups.insert(r, groups.size() + 1);
+
+        mData[images[i]].similarGroup = *igroup;
+    }
 }
 
 QPixmap FileInfoModel::coloredSquarePixmap(QColor color, int size)
@@ -153,51 +425,399 @@ QPixmap FileInfoModel::coloredSquarePixmap(QColor color, int size)
 
 void FileInfoModel::Collector::collect(const QList<QUrl>& urls)
 {
+    appendUrls(urls);
+    collect();
+}
+
+void FileInfoModel::Collector::collect()
+{
+    if (!mReferenceKey.isEmpty())
+        compare();
+    else if (mOptions.memoryBudget > 0)
+        collectExternal();
+    else
+        collectAll();
+
+    Progress::end();
+}
+
+void FileInfoModel::Collector::appendReferences(const QList<QUrl>& urls)
+{
+    // the set is listed separately, so the collected files and directories are put aside meanwhile
+    QStringList roots, files;
+    mRoots.swap(roots);
+    mPending.swap(files);
+
+    appendUrls(urls);
+    mReferenceRoots.append(mRoots);
+    mReferenceFiles.append(mPending);
+
+    mRoots.swap(roots);
+    mPending.swap(files);
+
     for (const auto& url: urls)
+        if (!url.isEmpty())
+            mReferenceKey.append(QFileInfo(url.toLocalFile()).absoluteFilePath());
+}
+
+void FileInfoModel::Collector::collectAll()
+{
+    Progress::begin(Progress::eList);
+
+    // the directory hashes need all the entries, not only the hashed files
+    if (mOptions.directories)
+        mRecordListings = true;
+
+    // the roots of the failed workers are scanned here
+    const auto local = mOptions.workers > 0 && !mRoots.isEmpty() ? scanShards() : mRoots;
+    for (const auto& root: local)
+        traverse(root);
+
+    hashPending();
+    if (isCancelled())
+        return;
+
+    if (mOptions.directories)
+        hashDirectories();
+
+    // after the directory hashes, members do not belong to any directory
+    if (mOptions.archives)
+        hashArchives();
+
+    if (mOptions.images && !isCancelled())
+        calculateImageHashes();
+
+    if (mOptions.directories)
+        collapseDirectories();
+}
+
+void FileInfoModel::Collector::compare()
+{
+    if (mLastClickedButton == QMessageBox::Cancel)
+        return;
+
+    Progress::begin(Progress::eList);
+
+    // both sets are listed and stat'ed before anything is read
+    auto list = [this](const QStringList& roots, const QStringList& files) {
+        mPending = files;
+        for (const auto& root: roots)
+            traverse(root);
+
+        QVector<Entry> entries;
+        entries.reserve(mPending.size());
+        for (const auto& path: qAsConst(mPending))
+        {
+            Profiler::Scope scope(Profiler::eStat);
+            const QFileInfo info(path);
+            if (info.exists())
+                entries.append({ info.absoluteFilePath(), info.size(), info.lastModified() });
+        }
+        mPending.clear();
+        return entries;
+    };
+
+    const auto candidates = std::exchange(mPending, {});
+    const auto referenceFiles = list(mReferenceRoots, mReferenceFiles);
+    const auto candidateFiles = list(mRoots, candidates);
+
+    // only the sizes present in both sets can give a cross-set match
+    QSet<QString> referencePaths;
+    QSet<qint64> referenceSizes;
+    for (const auto& file: referenceFiles)
     {
-        if (url.isEmpty()) continue;
+        referencePaths.insert(file.path);
+        referenceSizes.insert(file.size);
+    }
 
-        const auto path = url.toLocalFile();
-        QFileInfo entry(path);
+    QSet<qint64> commonSizes;
+    for (const auto& file: candidateFiles)
+        if (referenceSizes.contains(file.size))
+            commonSizes.insert(file.size);
 
-        if (entry.isDir())
-            appendDir(path);
-        else
-            appendFile(path);
+    ReferenceCache cache(mReferenceKey);
 
-        if (mLastClickedButton == QMessageBox::Cancel)
-            break;
+    // the cached hash is useless if the tree hash threshold was changed since
+    auto isExpectedHash = [this](const FileItem& item) {
+        return TreeHash::isTreeHash(item.hash) == (mOptions.treeHashThreshold > 0 && item.size >= mOptions.treeHashThreshold);
+    };
+
+    // the cache is consulted for all the references, so the entries of the unchanged files are kept
+    QList<FileItem> referenceItems;
+    QSet<QString> hashedReferences;
+    for (const auto& file: referenceFiles)
+    {
+        FileItem item;
+        if (cache.find(file.path, file.size, file.lastModified, &item) && isExpectedHash(item))
+        {
+            if (commonSizes.contains(file.size))
+                referenceItems.append(item);
+        }
+        else if (commonSizes.contains(file.size))
+        {
+            hashedReferences.insert(file.path);
+            mPending.append(file.path);
+        }
+    }
+
+    // a file under both a reference and a candidate root is not a copy of itself
+    for (const auto& file: candidateFiles)
+        if (commonSizes.contains(file.size) && !referencePaths.contains(file.path))
+            mPending.append(file.path);
+
+    hashPending();
+
+    QList<FileItem> candidateItems;
+    for (const auto& item: qAsConst(mItems))
+    {
+        if (hashedReferences.contains(item.fileInfo.absoluteFilePath()))
+        {
+            cache.insert(item);
+            referenceItems.append(item);
+        }
+        else
+        {
+            candidateItems.append(item);
+        }
     }
+
+    QString warning;
+    if (!cache.save(&warning))
+        mWarnings.append(warning);
+
+    QSet<QByteArray> referenceHashes, candidateHashes;
+    for (const auto& item: qAsConst(referenceItems))
+        referenceHashes.insert(item.hash);
+    for (const auto& item: qAsConst(candidateItems))
+        candidateHashes.insert(item.hash);
+
+    // the candidates first, each reference copy once
+    mItems.clear();
+    for (const auto& item: qAsConst(candidateItems))
+        if (referenceHashes.contains(item.hash))
+            mItems.append(item);
+    for (const auto& item: qAsConst(referenceItems))
+        if (candidateHashes.contains(item.hash))
+            mItems.append(item);
 }
 
-void FileInfoModel::Collector::appendFile(const QString& path)
+bool FileInfoModel::Collector::hashFile(const QString& path, FileItem* item, QString* warning, quint64 device,
+                                        qint64 treeThreshold, int treeThreads)
 {
     QFile file(path);
+    const QFileInfo info(path);
     QCryptographicHash hashCalculator(QCryptographicHash::Algorithm::Sha1);
 
+    // stat before reading, so later changes are detected by the watcher
+
+    item->fileInfo = info;
+    {
+        Profiler::Scope scope(Profiler::eStat);
+        item->size = info.size();
+        item->lastModified = info.lastModified();
+    }
+
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+    {
+        *warning = QObject::tr("Unable to open '%1'").arg(path);
+        return false;
+    }
+
+    // only the allocated regions of a sparse file are read, so the hash is the same as of a dense read
+    qint64 size = 0;
+    QVector<SparseFile::Region> regions;
+    const bool sparse = SparseFile::dataRegions(file.handle(), &size, &regions);
+
+    // a large file is hashed by several threads, the digest is of another type
+    if (treeThreshold > 0 && item->size >= treeThreshold)
+    {
+        if (!TreeHash::calculate(path, item->size, device, treeThreads, sparse ? &regions : nullptr, &item->hash))
+        {
+            *warning = QObject::tr("Cannot read '%1'").arg(path);
+            return false;
+        }
+
+        Profiler::addFile(item->size);
+        return true;
+    }
+
     // calculate file sha-1 hash
 
-    if (!file.open(QIODevice::ReadOnly))
+    QByteArray buffer(mcBufferSize, Qt::Uninitialized);
+    const bool read = sparse ? SparseFile::hashRange(&file, 0, size, regions, &buffer, &hashCalculator, device)
+                             : SparseFile::hashRange(&file, -1, &buffer, &hashCalculator, device);
+    if (!read)
     {
-        mWarnings.append(QObject::tr("Unable to open '%1'").arg(path));
-        return;
+        *warning = QObject::tr("Cannot read '%1'").arg(path);
+        return false;
     }
 
-    if (!hashCalculator.addData(&file))
+    item->hash = hashCalculator.result();
+    Profiler::addFile(item->size);
+    return true;
+}
+
+void FileInfoModel::Collector::hashPending()
+{
+    Progress::begin(Progress::eHash, mPending.size());
+    const auto devices = IoScheduler::schedule(mPending);
+
+    QVector<FileItem> items(mPending.size());
+    QVector<QString> warnings(mPending.size());
+    std::vector<char> hashed(static_cast<size_t>(mPending.size()), false);
+    std::atomic<int> done(0);
+
+    // workers access the containers through pointers, so nothing is detached from other threads
+    const auto pending = mPending.toVector();
+    const QString* paths = pending.constData();
+    FileItem* results = items.data();
+    QString* errors = warnings.data();
+
+    // each device gets its own lanes, so a slow disk does not hold the others
+    QThreadPool pool;
+    int lanes = 0;
+    int solidStateLanes = 0;
+    for (const auto& device: devices)
+    {
+        lanes += std::min(device.concurrency, device.files.size());
+        if (!device.rotational)
+            solidStateLanes += std::min(device.concurrency, device.files.size());
+    }
+    pool.setMaxThreadCount(std::max(lanes, 1));
+
+    // the chunks of a large file are read in parallel from solid state devices only; the lanes share
+    // the cores, so all the lanes hashing large files at once do not start more threads than there are cores
+    const int solidStateTreeThreads = std::max(QThread::idealThreadCount() / std::max(solidStateLanes, 1), 1);
+
+    QVector<QFuture<void>> futures;
+    for (const auto& device: devices)
+    {
+        const int concurrency = std::min(device.concurrency, device.files.size());
+        const int treeThreads = device.rotational ? 1 : solidStateTreeThreads;
+
+        for (int lane = 0; lane < concurrency; ++lane)
+        {
+            futures.append(QtConcurrent::run(&pool, [&, lane, concurrency, treeThreads] {
+                for (int k = lane; k < device.files.size() && !isCancelled(); k += concurrency)
+                {
+                    const int i = device.files[k];
+                    Progress::sample(paths[i]);
+                    hashed[static_cast<size_t>(i)] = hashFile(paths[i], &results[i], &errors[i], device.id,
+                                                              mOptions.treeHashThreshold, treeThreads);
+                    Progress::add(1, results[i].size);
+                    if (hashed[static_cast<size_t>(i)] && mHashedCallback)
+                    {
+                        mHashedCallback(results[i]);
+                        results[i] = FileItem();
+                    }
+                    Profiler::setQueueDepth(pending.size() - ++done);
+                }
+            }));
+        }
+    }
+
+    for (auto& future: futures)
+        future.waitForFinished();
+
+    // keep the traversal order; the files skipped after cancel() have no warning
+    for (int i = 0; i < mPending.size(); ++i)
+    {
+        if (!hashed[static_cast<size_t>(i)])
+        {
+            if (!warnings[i].isEmpty())
+                mWarnings.append(warnings[i]);
+        }
+        else if (!mHashedCallback)
+            mItems.append(items[i]);
+    }
+
+    mPending.clear();
+}
+
+void FileInfoModel::Collector::hashArchives()
+{
+    struct Archive
+    {
+        QString path;
+        qint64 size;
+        QVector<ArchiveReader::Member> members;
+        QString error;
+        bool ok = false;
+    };
+
+    QVector<Archive> archives;
+    qint64 bytes = 0;
+    for (const auto& item: qAsConst(mItems))
     {
-        mWarnings.append(QObject::tr("Cannot read '%1'").arg(path));
+        if (ArchiveReader::isArchive(item.fileInfo.absoluteFilePath()))
+        {
+            archives.append({ item.fileInfo.absoluteFilePath(), item.size, {}, {}, false });
+            bytes += item.size;
+        }
+    }
+
+    if (archives.isEmpty())
         return;
+
+    Progress::begin(Progress::eArchives, archives.size(), bytes);
+
+    // each archive is streamed through a few fixed-size buffers, so the memory is bounded by the pool size
+    const auto treeThreshold = mOptions.treeHashThreshold;
+    QtConcurrent::blockingMap(archives, [this, treeThreshold](Archive& archive) {
+        if (isCancelled())
+            return;
+        Progress::sample(archive.path);
+        archive.ok = ArchiveReader::read(archive.path, treeThreshold, &archive.members, &archive.error);
+        Progress::add(1, archive.size);
+    });
+
+    for (const auto& archive: qAsConst(archives))
+    {
+        if (!archive.ok)
+            mWarnings.append(archive.error);
+
+        for (const auto& member: archive.members)
+        {
+            const auto path = ArchiveReader::memberPath(archive.path, member.name);
+            if (path.isEmpty())
+            {
+                mWarnings.append(QObject::tr("Skipped the member '%1' of '%2': invalid name").arg(member.name, archive.path));
+                continue;
+            }
+
+            FileItem item;
+            item.fileInfo = QFileInfo(path);
+            item.hash = member.hash;
+            item.size = member.size;
+            item.lastModified = member.lastModified;
+            item.isMember = true;
+            mItems.append(item);
+        }
     }
+}
 
-    StatusMessage::show(QObject::tr("Calculate hash for '%1'...").arg(path), StatusMessage::mcInfinite);
-    const auto hash = hashCalculator.result();
+void FileInfoModel::Collector::appendUrls(const QList<QUrl>& urls)
+{
+    for (const auto& url: urls)
+    {
+        if (mLastClickedButton == QMessageBox::Cancel)
+            break;
 
-    mItems.append({path, hash, {}});
+        if (url.isEmpty()) continue;
+
+        const auto path = url.toLocalFile();
+        QFileInfo entry(path);
+
+        if (entry.isDir())
+            appendDir(path);
+        else
+            mPending.append(path);
+    }
 }
 
 void FileInfoModel::Collector::appendDir(const QString& path)
 {
-    if (mLastClickedButton != QMessageBox::YesToAll)
+    if (mParent && mLastClickedButton != QMessageBox::YesToAll)
     {
         mLastClickedButton = QMessageBox::question(mParent, "",
             QObject::tr("'%1' is a directory.\nDo you want to add all files from this directory?").arg(path),
@@ -207,9 +827,365 @@ void FileInfoModel::Collector::appendDir(const QString& path)
             return;
     }
 
-    QDirIterator files(path, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
-    while (files.hasNext())
+    if (mRoots.isEmpty()) // once per collection
+        mWarnings.append(mFilter.errors());
+
+    mRoots.append(QDir(path).absolutePath());
+}
+
+QStringList FileInfoModel::Collector::scanShards()
+{
+    ShardedScan scan(mOptions);
+    scan.setCancelFlag(&mCancelled);
+    scan.run(mRoots);
+    mItems.append(scan.items());
+    mWarnings.append(scan.warnings());
+    for (auto listing = scan.listings().cbegin(); listing != scan.listings().cend(); ++listing)
+        mListings.insert(listing.key(), listing.value());
+    return scan.failed();
+}
+
+void FileInfoModel::Collector::traverse(const QString& root)
+{
+    const auto prefix = root.endsWith('/') ? root : root + '/';
+    quint64 device = 0;
+    const bool sameFilesystem = mFilter.sameFilesystem() && ScanFilter::device(root, &device);
+
+    // a manual stack instead of QDirIterator::Subdirectories, so excluded subtrees are skipped as a whole
+    QStringList dirs = { root };
+    while (!dirs.isEmpty() && !isCancelled())
     {
-        appendFile(files.next());
+        const auto dir = dirs.takeLast();
+        Progress::sample(dir);
+
+        // nothing is inserted into mListings until the next directory, so the pointer stays valid
+        Listing* listing = mRecordListings ? &mListings[dir] : nullptr;
+        if (listing && !QDir(dir).isReadable())
+            listing->readable = false;
+
+        QDirIterator entries(dir, QDir::Files | QDir::Dirs | QDir::Hidden | QDir::NoDotAndDotDot);
+        for (;;)
+        {
+            QString entry;
+            QFileInfo info;
+            {
+                Profiler::Scope scope(Profiler::eTraverse);
+                if (!entries.hasNext())
+                    break;
+                entry = entries.next();
+                info = entries.fileInfo(); // the type is known from readdir, no stat yet
+            }
+
+            const auto relative = entry.mid(prefix.size());
+            auto exclude = [&] {
+                if (listing)
+                    listing->excluded.append(info.fileName());
+            };
+
+            if (info.isDir())
+            {
+                quint64 subdirDevice = 0;
+                if (!info.isSymLink() && mFilter.acceptsDir(relative) &&
+                        (!sameFilesystem || (ScanFilter::device(entry, &subdirDevice) && subdirDevice == device)))
+                {
+                    dirs.append(entry);
+                    if (listing)
+                        listing->dirs.append(info.fileName());
+                }
+                else
+                {
+                    exclude();
+                }
+                continue;
+            }
+
+            if (!mFilter.acceptsFile(relative))
+            {
+                exclude();
+                continue;
+            }
+
+            if (mFilter.needsStat())
+            {
+                Profiler::Scope scope(Profiler::eStat);
+                if (!mFilter.acceptsStat(info.size(), info.lastModified()))
+                {
+                    exclude();
+                    continue;
+                }
+            }
+
+            if (listing)
+                listing->files.append(info.fileName());
+            appendPending(entry, info);
+            Progress::add(1);
+        }
+    }
+}
+
+void FileInfoModel::Collector::appendPending(const QString& path, const QFileInfo& info)
+{
+    if (!mBySize)
+    {
+        mPending.append(path);
+        return;
     }
+
+    ExternalSort::Record record;
+    {
+        Profiler::Scope scope(Profiler::eStat);
+        record.size = info.size();
+        record.lastModified = info.lastModified().toMSecsSinceEpoch();
+    }
+    record.path = path;
+
+    // the error is reported after the traversal
+    mBySize->append(record);
+}
+
+namespace {
+
+constexpr qint64 cFileInfoMemory = 512; ///< QFileInfoPrivate: the cached path forms and the stat data
+constexpr qint64 cAllocationOverhead = 16; ///< Heap bookkeeping per allocation
+
+/// The approximate memory a file takes while its batch is hashed by hashPending: the pending path and
+/// its vector copy, which shares the characters, the schedule entry, the result item with its QFileInfo
+/// (a few path forms), hash and modification time, the copy in mItems, which shares them, and the warning slot
+qint64 batchMemory(const QString& path)
+{
+    const qint64 pathMemory = 2 * static_cast<qint64>(sizeof(QString)) + path.size() * 2 + cAllocationOverhead;
+    const qint64 scheduleMemory = static_cast<qint64>(sizeof(int) + sizeof(quint64));
+    const qint64 itemMemory = 2 * static_cast<qint64>(sizeof(FileItem)) + cFileInfoMemory + path.size() * 2 * 2 +
+            QCryptographicHash::hashLength(QCryptographicHash::Sha1) + 3 * cAllocationOverhead;
+    return pathMemory + scheduleMemory + itemMemory + static_cast<qint64>(sizeof(QString));
+}
+
+} // namespace
+
+void FileInfoModel::Collector::collectExternal()
+{
+    // two sorters work at the same time: the one being merged is on disk, the other one is being filled
+    const qint64 budget = static_cast<qint64>(mOptions.memoryBudget) * 1024 * 1024 / 2;
+
+    Progress::begin(Progress::eList);
+    ExternalSort bySize(budget);
+    mBySize = &bySize;
+    const auto files = mPending;
+    mPending.clear();
+    for (const auto& path: files)
+        appendPending(path, QFileInfo(path));
+    for (const auto& root: qAsConst(mRoots))
+        traverse(root);
+    mBySize = nullptr;
+
+    // only the files of the same size are hashed, by batches which fit in the budget
+    ExternalSort byHash(budget);
+    qint64 batchUsed = 0;
+    auto hashBatch = [&] {
+        hashPending();
+        for (const auto& item: qAsConst(mItems))
+            byHash.append({ item.size, item.lastModified.toMSecsSinceEpoch(), item.hash, item.fileInfo.absoluteFilePath() });
+        mItems.clear();
+        batchUsed = 0;
+    };
+    auto appendBatch = [&](const ExternalSort::Record& record) {
+        mPending.append(record.path);
+        batchUsed += batchMemory(record.path);
+        if (batchUsed >= budget)
+            hashBatch();
+    };
+
+    // the first file of a size is held until the second one comes, so a group takes no memory
+    ExternalSort::Record first;
+    int count = 0;
+    const bool listed = bySize.merge([&](const ExternalSort::Record& record) {
+        if (count > 0 && record.size == first.size)
+        {
+            if (++count == 2)
+                appendBatch(first);
+            appendBatch(record);
+        }
+        else
+        {
+            first = record;
+            count = 1;
+        }
+        return true;
+    });
+    hashBatch();
+
+    if (!listed || !byHash.errorString().isEmpty())
+    {
+        const auto error = !listed ? bySize.errorString() : byHash.errorString();
+        mWarnings.append(QObject::tr("Unable to sort the files on disk: %1").arg(error));
+        return;
+    }
+
+    // only the duplicates are collected
+    count = 0;
+    const bool grouped = byHash.merge([&](const ExternalSort::Record& record) {
+        if (count > 0 && record.size == first.size && record.hash == first.hash)
+        {
+            auto append = [this](const ExternalSort::Record& r) {
+                FileItem item{ QFileInfo(r.path), r.hash };
+                item.size = r.size;
+                item.lastModified = QDateTime::fromMSecsSinceEpoch(r.lastModified);
+                mItems.append(item);
+            };
+            if (++count == 2)
+                append(first);
+            append(record);
+        }
+        else
+        {
+            first = record;
+            count = 1;
+        }
+        return true;
+    });
+
+    if (!grouped)
+        mWarnings.append(QObject::tr("Unable to sort the files on disk: %1").arg(byHash.errorString()));
+}
+
+void FileInfoModel::Collector::hashDirectories()
+{
+    // the hashed files by path, so each directory finds its files without scanning all the items
+    QHash<QString, const FileItem*> files;
+    files.reserve(mItems.size());
+    for (const auto& item: qAsConst(mItems))
+        files.insert(item.fileInfo.absoluteFilePath(), &item);
+
+    // children first
+    auto dirs = mListings.keys();
+    std::sort(dirs.begin(), dirs.end(), [](const QString& lhs, const QString& rhs) {
+        return lhs.count('/') > rhs.count('/');
+    });
+
+    for (const auto& dir: qAsConst(dirs))
+    {
+        const auto& listing = *mListings.constFind(dir);
+        const auto prefix = dir.endsWith('/') ? dir : dir + '/';
+        DirInfo info;
+        info.complete = listing.readable;
+
+        // children names --> typed child hash; QMap keeps names sorted,
+        // so the hash does not depend on the order of QDirIterator
+        QMap<QString, QByteArray> children;
+        for (const auto& name: listing.files)
+        {
+            const auto file = files.value(prefix + name);
+            if (!file) // could not be read
+            {
+                info.complete = false;
+                continue;
+            }
+
+            children.insert(name, 'f' + file->hash);
+            info.size += file->size;
+        }
+
+        for (const auto& name: listing.dirs)
+        {
+            const auto subdir = mDirs.constFind(prefix + name);
+            if (subdir == mDirs.cend())
+            {
+                info.complete = false;
+                continue;
+            }
+
+            children.insert(name, 'd' + subdir->hash);
+            info.size += subdir->size;
+            info.complete = info.complete && subdir->complete;
+        }
+
+        for (const auto& name: listing.excluded)
+            children.insert(name, "x");
+
+        QCryptographicHash hashCalculator(QCryptographicHash::Algorithm::Sha1);
+        for (auto child = children.cbegin(); child != children.cend(); ++child)
+        {
+            hashCalculator.addData(child.key().toUtf8());
+            hashCalculator.addData("\0", 1);
+            hashCalculator.addData(child.value());
+        }
+
+        info.hash = hashCalculator.result();
+        mDirs.insert(dir, info);
+    }
+}
+
+void FileInfoModel::Collector::collapseDirectories()
+{
+    QHash<QByteArray, int> copies; // Merkle hash --> number of directories
+    for (const auto& dir: qAsConst(mDirs))
+        if (dir.size > 0 && dir.complete)
+            ++copies[dir.hash];
+
+    auto isDuplicate = [&](const QString& path) {
+        const auto dir = mDirs.constFind(path);
+        return dir != mDirs.cend() && dir->size > 0 && dir->complete && copies.value(dir->hash) > 1;
+    };
+
+    // the nearest ancestor reported as a whole, or an empty string
+    auto collapsedAncestor = [&](QString path) {
+        QString found;
+        for (;;)
+        {
+            if (isDuplicate(path))
+                found = path;
+
+            const auto parent = QFileInfo(path).absolutePath();
+            if (parent == path || !mDirs.contains(parent))
+                return found;
+            path = parent;
+        }
+    };
+
+    // only the topmost identical directories are reported, their subdirectories are identical too
+    QList<FileItem> items;
+    QList<QString> collapsed;
+    for (const auto& item: qAsConst(mItems))
+    {
+        const auto dir = collapsedAncestor(item.fileInfo.absolutePath());
+        if (dir.isEmpty())
+        {
+            items.append(item);
+            continue;
+        }
+
+        if (!mCollapsed.contains(dir))
+            collapsed.append(dir);
+        mCollapsed[dir].append(item);
+    }
+
+    for (const auto& path: collapsed)
+    {
+        FileItem dir{ QFileInfo(path), mDirs[path].hash };
+        dir.isDir = true;
+        dir.size = mDirs[path].size;
+        dir.lastModified = dir.fileInfo.lastModified();
+        items.append(dir);
+    }
+
+    mItems = items;
+}
+
+void FileInfoModel::Collector::calculateImageHashes()
+{
+    Progress::begin(Progress::eImages, mItems.size());
+
+    // decoding is the bottleneck here, so images are processed by all cores
+    const auto algorithm = mOptions.imageAlgorithm;
+    std::atomic<int> queued(mItems.size());
+    QtConcurrent::blockingMap(mItems, [this, algorithm, &queued](FileItem& item) {
+        if (isCancelled())
+            return;
+        Profiler::Scope scope(Profiler::eImage);
+        const auto path = item.fileInfo.absoluteFilePath();
+        Progress::sample(path);
+        item.isImage = !item.isMember && ImageHash::isImage(path) && ImageHash::calculate(path, algorithm, &item.imageHash);
+        Progress::add(1);
+        Profiler::setQueueDepth(--queued);
+    });
 }
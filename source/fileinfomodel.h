@@ -1,20 +1,40 @@
 #ifndef FILEINFOMODEL_H
 #define FILEINFOMODEL_H
 
+#include <atomic>
+#include <functional>
 #include <set>
 
 #include <QAbstractTableModel>
 #include <QFileInfo>
 #include <QByteArray>
+#include <QHash>
+#include <QDateTime>
 #include <QPixmap>
+#include <QRandomGenerator>
+
+#include "scanoptions.h"
+
+class ExternalSort;
 
 struct FileItem
 {
     QFileInfo fileInfo;
     QByteArray hash;
+    qint64 size = 0; ///< The file size when the hash was calculated
+    QDateTime lastModified; ///< The modification time when the hash was calculated
     QPixmap pixmap;
+    quint64 imageHash = 0; ///< Perceptual hash, valid if isImage is set
+    bool isImage = false;
+    int similarGroup = 0; ///< 1-based number of the visually similar images group, 0 if there are no similar images
+    QPixmap similarPixmap;
+    bool isDir = false; ///< The whole directory which has identical copies, see Collector::collapseDirectories
+    bool isMember = false; ///< A member of an archive, fileInfo is 'archive!/inner/path', see ArchiveReader
 };
 
+/// Files of the directories reported as a single entry: directory path --> files
+using CollapsedDirs = QHash<QString, QList<FileItem>>;
+
 class FileInfoModel : public QAbstractTableModel
 {
     Q_OBJECT
@@ -22,31 +42,178 @@ class FileInfoModel : public QAbstractTableModel
 public:
     using QAbstractTableModel::QAbstractTableModel;
 
-    enum { eName, eDir, eSize, eLastModified, eHash, ColCount };
+    enum { eName, eDir, eSize, eLastModified, eHash, eSimilar, ColCount };
 
     /// The class accumulates warnings while generating a list of items
     class Collector
     {
     public:
-        Collector(QWidget* parent) : mParent(parent) {}
+        /// Without parent the collection is non-interactive: directories are added without asking
+        Collector(QWidget* parent, const ScanOptions& options) : mParent(parent), mOptions(options), mFilter(options.filter) {}
+
+        /// The entries of a directory as listed by traverse, see hashDirectories
+        struct Listing
+        {
+            QStringList files; ///< Accepted by the filter, hashed unless they cannot be read
+            QStringList dirs; ///< Descended into
+            QStringList excluded; ///< Files and directories skipped by the filter, symlinks to directories
+            bool readable = true; ///< False if the directory could not be listed
+        };
+
+        /// Add the files and the directories to collect; asks about the directories, so it is called
+        /// from the GUI thread before collect()
+        void appendUrls(const QList<QUrl>& urls);
+
+        /// Add the reference set: the appended files become candidates, see compare()
+        void appendReferences(const QList<QUrl>& urls);
+
+        /// Collect the appended files; may run in a background thread, the progress is reported to Progress
+        void collect();
+
+        /// appendUrls() and collect()
         void collect(const QList<QUrl>& urls);
 
         const auto& collected() const { return mItems; }
+        const auto& collapsed() const { return mCollapsed; }
+        const auto& roots() const { return mRoots; }
         const auto& warnings() const { return mWarnings; }
 
+        /// Directory --> its entries; recorded in the directories mode or if setRecordListings() is called
+        const auto& listings() const { return mListings; }
+
+        /// Record the listings without processing the directories, they are processed by the coordinator
+        /// of ShardedScan workers
+        void setRecordListings(bool record) { mRecordListings = record; }
+
+        /// Pass each file to the callback as soon as it is hashed instead of keeping it in collected(), so
+        /// the results are streamed and the memory does not grow with the number of files; the callback
+        /// is called from the hashing threads
+        /// Used by ShardedScan workers, which leave the directories, archives and images to the coordinator
+        void setHashedCallback(const std::function<void(const FileItem&)>& callback) { mHashedCallback = callback; }
+
+        /// Stop the running collection as soon as possible, collected() is incomplete then; thread-safe
+        void cancel() { mCancelled = true; }
+        bool isCancelled() const { return mCancelled; }
+
+        static const int mcBufferSize = 256 * 1024; ///< Files are read and hashed by chunks of this size
+
+        /// Calculate the file hash; thread-safe
+        /// The reads are limited by Throttle within the budget of the given device (st_dev)
+        /// Files of treeThreshold bytes or larger get TreeHash calculated by treeThreads threads, 0 disables it
+        /// Returns false and sets the localized warning on failure
+        static bool hashFile(const QString& path, FileItem* item, QString* warning, quint64 device = 0,
+                             qint64 treeThreshold = 0, int treeThreads = 1);
+
     private:
-        void appendFile(const QString& path);
+        /// Hash all the collected files
+        void collectAll();
+
+        /// Collect the candidate files which have copies among the reference files, and those copies;
+        /// duplicates within one set are not reported
+        /// Only the files of sizes present in both sets are read, the reference hashes of the files
+        /// not modified since the previous comparison are taken from ReferenceCache
+        /// Directories, archives and images options are not applied
+        void compare();
+
+        /// Ask whether the directory should be collected and add it to mRoots
         void appendDir(const QString &path);
 
+        /// Collect the files of the root accepted by mFilter; excluded directories are not descended into
+        /// All the entries are added to mListings if mRecordListings is set
+        void traverse(const QString& root);
+
+        /// Add the file to mPending, or to mBySize in the external memory mode
+        void appendPending(const QString& path, const QFileInfo& info);
+
+        /// The external memory mode: list the files sorted by size on disk, hash the files of the same size
+        /// by batches, sort them by hash on disk and collect the duplicates only; mOptions.memoryBudget
+        /// limits the records in memory, the directories, archives, images and workers options are not applied
+        void collectExternal();
+
+        /// Collect the roots in worker processes, see ShardedScan
+        /// Returns the roots which should be traversed in process
+        QStringList scanShards();
+        void calculateImageHashes();
+
+        /// Hash the pending files in parallel, in the order given by IoScheduler
+        void hashPending();
+
+        /// Hash the members of the collected archives in parallel, see ArchiveReader
+        void hashArchives();
+
+        /// Calculate Merkle hashes of the listed directories, bottom-up: a directory hash is calculated
+        /// from its children names and hashes; excluded entries count by name only, so a directory
+        /// differs from a copy with other excluded entries
+        /// A directory is not complete if it or some of its files or subdirectories could not be read
+        void hashDirectories();
+
+        /// Replace files of identical directories with single directory entries
+        void collapseDirectories();
+
+        /// A listed file of a compared set
+        struct Entry
+        {
+            QString path;
+            qint64 size = 0;
+            QDateTime lastModified;
+        };
+
+        struct DirInfo
+        {
+            QByteArray hash; ///< Merkle hash
+            qint64 size = 0;
+            bool complete = true; ///< All the entries were read, only complete directories are collapsed
+        };
+
+        QStringList mPending; ///< Files to be hashed
+        ExternalSort* mBySize = nullptr; ///< Receives the listed files in the external memory mode, see collectExternal
         QList<FileItem> mItems; ///< Collected data
+        CollapsedDirs mCollapsed;
+        QHash<QString, DirInfo> mDirs; ///< Hashes of all the collected directories
+        QHash<QString, Listing> mListings; ///< Directory --> its entries, see traverse
+        bool mRecordListings = false;
+        std::function<void(const FileItem&)> mHashedCallback; ///< See setHashedCallback
+        std::atomic<bool> mCancelled { false }; ///< See cancel
+        QStringList mRoots; ///< The directories collected as a whole
+        QStringList mReferenceRoots; ///< The directories of the reference set, see compare
+        QStringList mReferenceFiles; ///< The files of the reference set
+        QStringList mReferenceKey; ///< The reference set as added, identifies ReferenceCache
         QWidget* mParent = nullptr; ///< Used for QMessageBox
+        const ScanOptions mOptions;
+        const ScanFilter mFilter; ///< Compiled mOptions.filter
         QStringList mWarnings; ///< Localized non-fatal error messages
         /// The last button clicked by the user; values YesToAll or Cancel require some special processing
         int mLastClickedButton = 0;
     };
 
-    void add(const QList<FileItem>& items);
+    void add(const QList<FileItem>& items, const CollapsedDirs& collapsed = {});
     void remove(std::set<int, std::greater<int>>& rows);
+    void clear();
+
+    /// Replace directory entries with the files they contain
+    void expand(std::set<int, std::greater<int>>& rows);
+
+    /// Replace the directory entry and the entries of its identical copies with their files
+    void expand(const QString& dir);
+
+    /// Replace the items with the same paths and append new ones without resetting the model
+    void update(const QList<FileItem>& items);
+
+    /// Remove the items with the given paths, under the given directories or inside the given archives
+    /// without resetting the model
+    void remove(const QStringList& paths);
+
+    /// The row of the item with the given absolute path, -1 if there is no such item
+    int row(const QString& path) const { return mRows.value(path, -1); }
+
+    /// Paths of the items from the given directory (not including subdirectories)
+    QStringList files(const QString& dir) const;
+
+    /// The directory reported as a single entry which is or contains the path, an empty string if there is none
+    QString collapsedDir(const QString& path) const;
+
+    /// Maximum Hamming distance between perceptual hashes of similar images
+    void setImageDistance(int distance);
 
     // Header:
     QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
@@ -58,15 +225,37 @@ public:
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
 
     FileItem item(int row) const; // TODO: incapsulate
+    const QList<FileItem>& items() const { return mData; }
+    const CollapsedDirs& collapsed() const { return mCollapsed; }
 
 private:
     QVariant displayData(const QModelIndex &index) const;
     void updatePixmaps();
+    void updatePixmap(FileItem& item);
+    void updateSimilarGroups();
+    void updateSimilarPixmaps();
+    void updateRows();
 
     /// Draw a colored square pixmap with 1px black border
     static QPixmap coloredSquarePixmap(QColor color, int size = 16);
 
+    /// Distinct colors for groups: basic colors first, then random ones
+    class ColorGenerator
+    {
+    public:
+        QColor next();
+
+    private:
+        int mColor = Qt::lightGray; // darkGray, gray and lightGray looks like the same color in the list, so we start from lightGray
+        QRandomGenerator mRand;
+    };
+
     QList<FileItem> mData;
+    QHash<QString, int> mRows; ///< Absolute path --> row
+    CollapsedDirs mCollapsed;
+    ColorGenerator mHashColors;
+    QHash<QByteArray, QPixmap> mColors; ///< Each hash have unique color pixmap, shared by its rows and kept while the model lives
+    int mImageDistance = ScanOptions().imageDistance;
 };
 
 #endif // FILEINFOMODEL_H
@@ -6,6 +6,7 @@
 #include <QDir>
 #include <QDirIterator>
 #include <QDropEvent>
+#include <QEventLoop>
 #include <QHeaderView>
 #include <QMessageBox>
 #include <QMimeData>
@@ -14,9 +15,15 @@
 #include <QSortFilterProxyModel>
 #include <QStyledItemDelegate>
 #include <QTimer>
+#include <QtConcurrent>
 
+#include "archivereader.h"
+#include "dirwatcher.h"
 #include "fileinfomodel.h"
+#include "session.h"
 #include "statusmessage.h"
+#include "throttle.h"
+#include "treehash.h"
 #include "widgetlocker.h"
 
 class NumberDelegate : public QStyledItemDelegate
@@ -39,15 +46,19 @@ public:
 
     QString displayText(const QVariant& value, const QLocale&) const override
     {
-        return value.toByteArray().toBase64();
+        return TreeHash::toString(value.toByteArray());
     }
 };
 
 FileList::FileList(QWidget* parent) :
     QTreeView(parent),
     mModel(new FileInfoModel(this)),
-    mProxy(new QSortFilterProxyModel(this))
+    mProxy(new QSortFilterProxyModel(this)),
+    mWatcher(new DirWatcher(this))
 {
+    connect(mWatcher, &DirWatcher::changed, this, &FileList::refresh);
+    connect(&mValidation, &QFutureWatcher<QStringList>::finished, [this]{ refresh(mValidation.result()); });
+
     mProxy->setSourceModel(mModel);
     setModel(mProxy);
     setItemDelegateForColumn(FileInfoModel::eSize, new NumberDelegate(this));
@@ -92,29 +103,102 @@ void FileList::dropEvent(QDropEvent* e)
         return;
 
     e->acceptProposedAction();
-    add(e->mimeData()->urls());
+    if (e->keyboardModifiers() & Qt::ShiftModifier)
+        addReferences(e->mimeData()->urls());
+    else
+        add(e->mimeData()->urls());
+}
+
+void FileList::setOptions(const ScanOptions& options)
+{
+    // excluded directories are not watched, so new exclude patterns need new watches
+    if (options.watch != mOptions.watch || (options.watch && options.filter.exclude != mOptions.filter.exclude))
+    {
+        mWatcher->clear();
+        mWatcher->setFilter(ScanFilter(options.filter));
+        if (options.watch)
+            for (const auto& root: qAsConst(mRoots))
+                mWatcher->addTree(root);
+    }
+
+    mOptions = options;
+    mFilter = ScanFilter(options.filter);
+    mModel->setImageDistance(options.imageDistance);
+    Throttle::setLimits(options.throttle);
 }
 
 void FileList::add(const QList<QUrl>& urls)
 {
-    if (urls.isEmpty()) return;
+    if (urls.isEmpty() || mCollecting) return;
 
-    FileInfoModel::Collector collector(this);
+    FileInfoModel::Collector collector(this, mOptions);
+
+    // the questions are asked before the collection goes to background
+    if (!mReferences.isEmpty())
+        collector.appendReferences(mReferences);
+    collector.appendUrls(urls);
 
     {
         AppCursorLocker acl;
-        WidgetLocker wl(this);
+        runInBackground(&collector, [&collector] { collector.collect(); });
+        if (collector.isCancelled())
+            return;
+        mModel->add(collector.collected(), collector.collapsed());
+    }
+
+    // new files under the candidate roots are not compared, so the roots are not watched
+    if (!mReferences.isEmpty())
+    {
+        StatusMessage::show(tr("%n file(s) with copies in the reference", "", collector.collected().size()));
+        if (!collector.warnings().isEmpty())
+            QMessageBox::warning(this, "", collector.warnings().join("\n"));
+        return;
+    }
+
+    for (const auto& root: collector.roots())
+    {
+        if (mRoots.contains(root))
+            continue;
 
-        collector.collect(urls);
-        mModel->add(collector.collected());
+        mRoots.append(root);
+        if (mOptions.watch)
+            mWatcher->addTree(root);
     }
 
     if (!collector.warnings().isEmpty())
         QMessageBox::warning(this, "", collector.warnings().join("\n"));
 }
 
+void FileList::addReferences(const QList<QUrl>& urls)
+{
+    if (mCollecting) return;
+
+    for (const auto& url: urls)
+        if (!url.isEmpty() && !mReferences.contains(url))
+            mReferences.append(url);
+
+    if (mReferences.isEmpty())
+        return;
+
+    QStringList paths;
+    for (const auto& url: qAsConst(mReferences))
+        paths.append(url.toLocalFile());
+    StatusMessage::show(tr("Reference: '%1'. Drag'n'drop the files or directories to compare with it").arg(paths.join("', '")),
+                        StatusMessage::mcInfinite);
+}
+
+void FileList::clearReferences()
+{
+    if (mCollecting) return;
+
+    mReferences.clear();
+    StatusMessage::show(tr("Drag'n'drop files or directories here"), StatusMessage::mcInfinite);
+}
+
 void FileList::remove(QModelIndexList what)
 {
+    if (mCollecting) return;
+
     AppCursorLocker acl;
     WidgetLocker wl(this);
 
@@ -132,7 +216,21 @@ void FileList::removeSelected()
     remove(selectionModel()->selectedRows());
 }
 
-void FileList::selectNextDuplicates()
+void FileList::expandSelected()
+{
+    if (mCollecting) return;
+
+    AppCursorLocker acl;
+    WidgetLocker wl(this);
+
+    std::set<int, std::greater<int>> rows;
+    for (const auto& index: selectionModel()->selectedRows())
+        rows.insert(mProxy->mapToSource(index).row());
+
+    mModel->expand(rows);
+}
+
+void FileList::selectNextDuplicates(int column)
 {
     AppCursorLocker acl;
 
@@ -148,12 +246,18 @@ void FileList::selectNextDuplicates()
     if (selectionModel()->selectedRows().isEmpty() || topRow >= rowCount)
         topRow = 0;
 
-    auto top = mProxy->index(topRow, FileInfoModel::eHash);
+    auto top = mProxy->index(topRow, column);
     StatusMessage::show(tr("Search..."), StatusMessage::mcInfinite);
 
     while (top.isValid())
     {
         const auto hash = mProxy->data(top);
+        if (hash.isNull()) // e.g. not an image
+        {
+            top = indexBelow(top);
+            continue;
+        }
+
         setCurrentIndex(top);
 
         auto index = top;
@@ -166,7 +270,13 @@ void FileList::selectNextDuplicates()
         const auto size = selectionModel()->selectedRows().size();
         if (size > 1)
         {
-            const QString hashString(hash.toByteArray().toBase64());
+            if (column == FileInfoModel::eSimilar)
+            {
+                StatusMessage::show(tr("Found %n similar image(s)", "", size), StatusMessage::mcInfinite);
+                return;
+            }
+
+            const auto hashString = TreeHash::toString(hash.toByteArray());
             StatusMessage::show(tr("Found %n file(s) with hash %1", "", size).arg(hashString),
                                 StatusMessage::mcInfinite);
             return;
@@ -179,6 +289,11 @@ void FileList::selectNextDuplicates()
     StatusMessage::show(tr("No duplicates after row %1").arg(topRow));
 }
 
+bool FileList::isArchiveMember(const QModelIndex& index) const
+{
+    return index.isValid() && mModel->item(mProxy->mapToSource(index).row()).isMember;
+}
+
 QFileInfo FileList::fileInfo(const QModelIndex& index) const
 {
     if (!index.isValid() || index.row() >= mModel->rowCount())
@@ -187,6 +302,219 @@ QFileInfo FileList::fileInfo(const QModelIndex& index) const
     return mModel->item(mProxy->mapToSource(index).row()).fileInfo;
 }
 
+void FileList::refresh(const QStringList& paths)
+{
+    if (mCollecting) // try later
+    {
+        QTimer::singleShot(DirWatcher::mcDebounce, this, [this, paths]{ refresh(paths); });
+        return;
+    }
+
+    // only the files which size or modification time were changed are re-hashed
+    QList<QUrl> changed;
+    QStringList removed;
+
+    // a changed directory reported as a single entry is not identical to its copies anymore,
+    // so its files are listed separately and checked as usual
+    auto expandCollapsed = [this](const QString& path) {
+        const auto dir = mModel->collapsedDir(path);
+        if (!dir.isEmpty())
+            mModel->expand(dir);
+    };
+
+    auto check = [&](const QFileInfo& file) {
+        const auto path = file.absoluteFilePath();
+        expandCollapsed(path);
+
+        const int row = mModel->row(path);
+        if (row < 0 && !isCollectable(file))
+            return;
+
+        if (row >= 0)
+        {
+            const auto item = mModel->item(row);
+            if (item.size == file.size() && item.lastModified == file.lastModified())
+                return;
+
+            // the members are read again as a whole, the removed ones should disappear
+            if (mOptions.archives && ArchiveReader::isArchive(path))
+                removed.append(path);
+        }
+
+        changed.append(QUrl::fromLocalFile(path));
+    };
+
+    for (const auto& path: paths)
+    {
+        const QFileInfo info(path);
+        if (info.isDir())
+        {
+            // the directory contents were changed, but not necessarily reported per file
+            expandCollapsed(info.absoluteFilePath());
+            const QDir dir(path);
+            for (const auto& file: dir.entryInfoList(QDir::Files | QDir::Hidden))
+                check(file);
+            for (const auto& file: mModel->files(info.absoluteFilePath()))
+                if (!QFileInfo::exists(file))
+                    removed.append(file);
+        }
+        else if (info.exists())
+        {
+            check(info);
+        }
+        else
+        {
+            expandCollapsed(info.absoluteFilePath());
+            removed.append(info.absoluteFilePath());
+        }
+    }
+
+    if (!removed.isEmpty())
+        mModel->remove(removed);
+
+    if (changed.isEmpty())
+    {
+        if (!removed.isEmpty())
+            StatusMessage::show(tr("%n file(s) removed", "", removed.size()));
+        return;
+    }
+
+    auto options = mOptions;
+    options.directories = false;
+    options.memoryBudget = 0; // the changed files are listed even if they have no duplicates
+    FileInfoModel::Collector collector(this, options);
+    runInBackground(&collector, [&collector, &changed] { collector.collect(changed); });
+    if (collector.isCancelled())
+        return;
+    mModel->update(collector.collected());
+
+    StatusMessage::show(tr("%n file(s) updated", "", collector.collected().size()));
+}
+
+void FileList::cancel()
+{
+    if (mCollector)
+        mCollector->cancel();
+}
+
+void FileList::runInBackground(FileInfoModel::Collector* collector, const std::function<void()>& job)
+{
+    WidgetLocker wl(this);
+    mCollecting = true;
+    mCollector = collector;
+    emit collectingChanged(true);
+
+    QEventLoop loop;
+    QFutureWatcher<void> watcher;
+    connect(&watcher, &QFutureWatcher<void>::finished, &loop, &QEventLoop::quit);
+    watcher.setFuture(QtConcurrent::run(job));
+
+    if (!watcher.isFinished())
+        loop.exec();
+
+    // the loop is left early when the application quits, the job still refers to the caller's locals
+    watcher.waitForFinished();
+
+    mCollector = nullptr;
+    mCollecting = false;
+    emit collectingChanged(false);
+}
+
+bool FileList::saveSession(const QString& fileName)
+{
+    AppCursorLocker acl;
+
+    Session session;
+    session.items = mModel->items();
+    session.collapsed = mModel->collapsed();
+    session.roots = mRoots;
+
+    if (!session.save(fileName))
+    {
+        QMessageBox::warning(this, "", tr("Unable to save '%1': %2").arg(fileName, session.errorString()));
+        return false;
+    }
+
+    StatusMessage::show(tr("Session saved to '%1'").arg(fileName));
+    return true;
+}
+
+bool FileList::openSession(const QString& fileName)
+{
+    if (mCollecting)
+        return false;
+
+    Session session;
+
+    {
+        AppCursorLocker acl;
+        WidgetLocker wl(this);
+
+        if (session.load(fileName))
+        {
+            mModel->clear();
+            mModel->add(session.items, session.collapsed);
+        }
+    }
+
+    if (!session.errorString().isEmpty())
+    {
+        QMessageBox::warning(this, "", session.errorString());
+        return false;
+    }
+
+    mRoots = session.roots;
+    mWatcher->clear();
+    if (mOptions.watch)
+        for (const auto& root: qAsConst(mRoots))
+            mWatcher->addTree(root);
+
+    if (mOptions.validateSessions)
+        validate();
+
+    return true;
+}
+
+void FileList::validate()
+{
+    struct Stamp { QString path; qint64 size; QDateTime lastModified; };
+
+    QVector<Stamp> stamps;
+    stamps.reserve(mModel->items().size());
+    for (const auto& item: mModel->items())
+        if (!item.isDir && !item.isMember) // members are checked with their archives
+            stamps.append({ item.fileInfo.absoluteFilePath(), item.size, item.lastModified });
+
+    mValidation.setFuture(QtConcurrent::run([stamps] {
+        QStringList changed;
+        for (const auto& stamp: stamps)
+        {
+            const QFileInfo file(stamp.path);
+            if (!file.exists() || file.size() != stamp.size || file.lastModified() != stamp.lastModified)
+                changed.append(stamp.path);
+        }
+        return changed;
+    }));
+}
+
+bool FileList::isCollectable(const QFileInfo& file) const
+{
+    const auto path = file.absoluteFilePath();
+    for (const auto& root: mRoots)
+    {
+        const auto prefix = root.endsWith('/') ? root : root + '/';
+        if (!path.startsWith(prefix))
+            continue;
+
+        // the file may be in an excluded directory, which the watcher still reports
+        if (!mFilter.acceptsFile(path.mid(prefix.size())))
+            continue;
+
+        return !mFilter.needsStat() || mFilter.acceptsStat(file.size(), file.lastModified());
+    }
+    return false;
+}
+
 void FileList::highlightDropArea(bool on)
 {
     static const auto normal = palette();
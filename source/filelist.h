@@ -2,12 +2,17 @@
 #define FILELIST_H
 
 #include <deque>
+#include <functional>
 
 #include <QFileInfo>
+#include <QFutureWatcher>
 #include <QTreeView>
 #include <QUrl>
 
-class FileInfoModel;
+#include "fileinfomodel.h"
+#include "scanoptions.h"
+
+class DirWatcher;
 class QSortFilterProxyModel;
 
 /// QTreeWidget with top-level items only, presented file info
@@ -18,16 +23,50 @@ class FileList : public QTreeView
 public:
     explicit FileList(QWidget* parent);
 
+    const ScanOptions& options() const { return mOptions; }
+    void setOptions(const ScanOptions& options);
+
+    /// Collect the files; in the comparison mode, compare them with the references
     void add(const QList<QUrl>& urls);
+
+    /// Turn on the comparison mode: the added files are candidates, only the ones having copies
+    /// among the references are listed, together with the copies; see Collector::compare
+    void addReferences(const QList<QUrl>& urls);
+
+    /// Turn off the comparison mode
+    void clearReferences();
+
+    const QList<QUrl>& references() const { return mReferences; }
+
+    /// A collection runs in background; the list cannot be changed by another one meanwhile
+    bool isCollecting() const { return mCollecting; }
+
+    /// Stop the running collection, its results are discarded; e.g. when the application quits
+    void cancel();
     void remove(QModelIndexList what);
     void removeSelected();
 
-    /// Select the rows with the same 'Hash' column value
+    /// Replace the selected directory entries with their files
+    void expandSelected();
+
+    /// Select the rows with the same 'Hash' (or other given column) value
     /// Search from {current row + 1} or from begin, if nothing selected
-    void selectNextDuplicates();
+    void selectNextDuplicates(int column);
 
     QFileInfo fileInfo(const QModelIndex& index) const;
 
+    /// The item is inside an archive, so it cannot be opened or removed as a file
+    bool isArchiveMember(const QModelIndex& index) const;
+
+    /// Save the list to a session file; shows a message box on failure
+    bool saveSession(const QString& fileName);
+
+    /// Replace the list with the session file contents; shows a message box on failure
+    bool openSession(const QString& fileName);
+
+signals:
+    void collectingChanged(bool collecting);
+
 private:
     void dragEnterEvent(QDragEnterEvent* e) override;
     void dragMoveEvent(QDragMoveEvent* e) override;
@@ -37,11 +76,34 @@ private:
     /// Highlight the drop area
     void highlightDropArea(bool on = true);
 
+    /// Run the job in a background thread and wait for it; meanwhile the list is disabled, the other
+    /// widgets stay usable (e.g. the settings may change the throttle limits of the running scan),
+    /// the actions changing the list are disabled through collectingChanged; cancel() cancels the collector
+    void runInBackground(FileInfoModel::Collector* collector, const std::function<void()>& job);
+
+    /// Re-hash changed files and remove deleted ones, reported by the watcher
+    void refresh(const QStringList& paths);
+
+    /// The new file would be collected by a rescan: it is under one of the directories
+    /// added as a whole and is accepted by the filter
+    bool isCollectable(const QFileInfo& file) const;
+
+    /// Re-check sizes and modification times in background, then refresh changed files
+    void validate();
+
     /// Only local files can be dropped
     static bool isAcceptable(const QMimeData* mime);
 
     FileInfoModel* mModel = nullptr;
     QSortFilterProxyModel* mProxy = nullptr;
+    DirWatcher* mWatcher = nullptr;
+    QFutureWatcher<QStringList> mValidation;
+    QStringList mRoots; ///< Directories added as a whole, watched for new files
+    QList<QUrl> mReferences; ///< The reference set of the comparison mode
+    bool mCollecting = false; ///< Guards against reentrant collections from the nested event loop
+    FileInfoModel::Collector* mCollector = nullptr; ///< The running collection, see cancel
+    ScanOptions mOptions;
+    ScanFilter mFilter; ///< Compiled mOptions.filter
 };
 
 #endif // FILELIST_H
@@ -0,0 +1,137 @@
+#include "imagehash.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QSet>
+
+namespace {
+
+/// Decode the image directly into the given size; JPEG decoder does most of the downscaling
+/// while decompressing, so big photos are never loaded at their full resolution
+QImage readScaled(const QString& path, const QSize& size)
+{
+    QImageReader reader(path);
+    reader.setScaledSize(size);
+
+    QImage image = reader.read();
+    if (image.isNull())
+        return {};
+
+    if (image.size() != size)
+        image = image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+    return image.convertToFormat(QImage::Format_Grayscale8);
+}
+
+} // namespace
+
+bool ImageHash::isImage(const QString& path)
+{
+    static const auto formats = [] {
+        QSet<QByteArray> set;
+        for (const auto& format: QImageReader::supportedImageFormats())
+            set.insert(format.toLower());
+        return set;
+    }();
+
+    return formats.contains(QFileInfo(path).suffix().toLower().toLatin1());
+}
+
+bool ImageHash::calculate(const QString& path, Algorithm algorithm, quint64* hash)
+{
+    bool ok = false;
+
+    switch (algorithm)
+    {
+        case eDHash: *hash = dHash(path, &ok); break;
+        case ePHash: *hash = pHash(path, &ok); break;
+    }
+
+    return ok;
+}
+
+quint64 ImageHash::dHash(const QString& path, bool* ok)
+{
+    const auto image = readScaled(path, { 9, 8 });
+    *ok = !image.isNull();
+    if (!*ok)
+        return 0;
+
+    quint64 hash = 0;
+    for (int y = 0; y < 8; ++y)
+    {
+        const uchar* line = image.constScanLine(y);
+        for (int x = 0; x < 8; ++x)
+            hash = (hash << 1) | (line[x] < line[x + 1]);
+    }
+
+    return hash;
+}
+
+quint64 ImageHash::pHash(const QString& path, bool* ok)
+{
+    constexpr int N = 32; // the image is scaled to NxN
+    constexpr int K = 8;  // only KxK low frequencies are used
+
+    const auto image = readScaled(path, { N, N });
+    *ok = !image.isNull();
+    if (!*ok)
+        return 0;
+
+    // DCT-II basis for the low frequencies: cosines[u][x] = cos((2x + 1) * u * pi / 2N)
+    static const auto cosines = [] {
+        const double pi = std::acos(-1.0);
+        std::array<std::array<float, N>, K> c;
+        for (int u = 0; u < K; ++u)
+            for (int x = 0; x < N; ++x)
+                c[u][x] = static_cast<float>(std::cos((2 * x + 1) * u * pi / (2 * N)));
+        return c;
+    }();
+
+    // The 2D DCT is separable, so it is calculated as two matrix products: C * P * C^T
+    // Inner loops run over contiguous rows of floats, so the compiler can vectorize them
+
+    float pixels[N][N];
+    for (int y = 0; y < N; ++y)
+    {
+        const uchar* line = image.constScanLine(y);
+        for (int x = 0; x < N; ++x)
+            pixels[y][x] = line[x];
+    }
+
+    float rows[K][N] = {}; // C * P
+    for (int u = 0; u < K; ++u)
+        for (int y = 0; y < N; ++y)
+        {
+            const float c = cosines[u][y];
+            for (int x = 0; x < N; ++x)
+                rows[u][x] += c * pixels[y][x];
+        }
+
+    float dct[K * K]; // (C * P) * C^T
+    for (int u = 0; u < K; ++u)
+        for (int v = 0; v < K; ++v)
+        {
+            float sum = 0;
+            for (int x = 0; x < N; ++x)
+                sum += rows[u][x] * cosines[v][x];
+            dct[u * K + v] = sum;
+        }
+
+    // the DC coefficient is the average brightness, it is too big to take part in the median
+    float sorted[K * K - 1];
+    std::copy(dct + 1, dct + K * K, sorted);
+    std::nth_element(sorted, sorted + (K * K - 1) / 2, sorted + K * K - 1);
+    const float median = sorted[(K * K - 1) / 2];
+
+    quint64 hash = 0;
+    for (float coefficient: dct)
+        hash = (hash << 1) | (coefficient > median);
+
+    return hash;
+}
@@ -0,0 +1,36 @@
+#ifndef IMAGEHASH_H
+#define IMAGEHASH_H
+
+#include <QtAlgorithms>
+#include <QtGlobal>
+
+class QString;
+
+/// Perceptual image hashes: images which look alike have hashes with a small Hamming distance,
+/// regardless of their resolution or compression quality
+class ImageHash
+{
+public:
+    enum Algorithm
+    {
+        eDHash, ///< Difference hash: compares the brightness of adjacent pixels, fast
+        ePHash  ///< DCT hash: compares low frequencies with their median, more robust
+    };
+
+    /// Returns true if the file can be decoded by QImageReader (checked by suffix only)
+    static bool isImage(const QString& path);
+
+    /// Decodes the image at a reduced scale and calculates its hash
+    /// Returns false if the file cannot be decoded
+    /// The function is thread-safe
+    static bool calculate(const QString& path, Algorithm algorithm, quint64* hash);
+
+    /// The number of different bits
+    static int distance(quint64 lhs, quint64 rhs) { return qPopulationCount(lhs ^ rhs); }
+
+private:
+    static quint64 dHash(const QString& path, bool* ok);
+    static quint64 pHash(const QString& path, bool* ok);
+};
+
+#endif // IMAGEHASH_H
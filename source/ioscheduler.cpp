@@ -0,0 +1,173 @@
+#include "ioscheduler.h"
+
+#include <algorithm>
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "profiler.h"
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+QVector<IoScheduler::Device> IoScheduler::schedule(const QStringList& paths)
+{
+#ifdef Q_OS_LINUX
+    struct Entry
+    {
+        int index;
+        quint64 inode;
+        quint64 offset;
+    };
+
+    QHash<quint64, QVector<Entry>> byDevice;
+    QVector<int> unknown; // stat failed, the error will be reported while reading
+
+    for (int i = 0; i < paths.size(); ++i)
+    {
+        struct stat st;
+        bool ok = false;
+        {
+            Profiler::Scope scope(Profiler::eStat);
+            ok = ::stat(QFile::encodeName(paths[i]).constData(), &st) == 0;
+        }
+
+        if (ok)
+            byDevice[st.st_dev].append({ i, st.st_ino, 0 });
+        else
+            unknown.append(i);
+    }
+
+    QVector<Device> devices;
+    for (auto entries = byDevice.begin(); entries != byDevice.end(); ++entries)
+    {
+        Device device;
+        device.id = entries.key();
+        device.rotational = isRotational(device.id);
+        device.concurrency = device.rotational ? mcRotationalConcurrency : mcSolidStateConcurrency;
+
+        auto& files = entries.value();
+        if (device.rotational)
+        {
+            // physical offsets can only be compared with each other, so the inode order
+            // is used for the whole device if any of the offsets is unknown
+            bool physical = true;
+            for (auto& entry: files)
+            {
+                if (!physicalOffset(paths[entry.index], &entry.offset))
+                {
+                    physical = false;
+                    break;
+                }
+            }
+
+            std::sort(files.begin(), files.end(), [physical](const Entry& lhs, const Entry& rhs) {
+                return physical ? lhs.offset < rhs.offset : lhs.inode < rhs.inode;
+            });
+        }
+
+        device.files.reserve(files.size());
+        for (const auto& entry: files)
+            device.files.append(entry.index);
+
+        devices.append(device);
+    }
+
+    // nothing is read from these files, so they do not need the ordered reads of a rotational disk
+    if (!unknown.isEmpty())
+    {
+        Device device;
+        device.concurrency = mcSolidStateConcurrency;
+        device.files = unknown;
+        devices.append(device);
+    }
+
+    return devices;
+#else
+    Device device;
+    device.concurrency = mcSolidStateConcurrency;
+    device.files.reserve(paths.size());
+    for (int i = 0; i < paths.size(); ++i)
+        device.files.append(i);
+    return { device };
+#endif
+}
+
+bool IoScheduler::isRotational(quint64 device)
+{
+#ifdef Q_OS_LINUX
+    // collections run in background threads and may follow each other, e.g. retried refreshes
+    static QMutex mutex;
+    static QHash<quint64, bool> cache; // guarded by mutex
+    QMutexLocker lock(&mutex);
+
+    auto cached = cache.constFind(device);
+    if (cached != cache.cend())
+        return *cached;
+
+    // partitions have no queue, their parent disk does
+    const auto sysfs = QString("/sys/dev/block/%1:%2/").arg(major(device)).arg(minor(device));
+    bool rotational = false;
+    for (const auto& path: { sysfs + "queue/rotational", sysfs + "../queue/rotational" })
+    {
+        QFile file(path);
+        if (file.open(QIODevice::ReadOnly))
+        {
+            rotational = file.readAll().trimmed() == "1";
+            break;
+        }
+    }
+
+    cache.insert(device, rotational);
+    return rotational;
+#else
+    Q_UNUSED(device)
+    return false;
+#endif
+}
+
+bool IoScheduler::physicalOffset(const QString& path, quint64* offset)
+{
+#ifdef Q_OS_LINUX
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+    const int file = fd >= 0 ? fd : ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC); // O_NOATIME requires ownership
+    if (file < 0)
+        return false;
+
+    // room for one extent after the header
+    alignas(fiemap) char request[sizeof(fiemap) + sizeof(fiemap_extent)] = {};
+    const auto map = reinterpret_cast<fiemap*>(request);
+    map->fm_start = 0;
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+
+    bool ok = ::ioctl(file, FS_IOC_FIEMAP, map) == 0;
+    if (ok)
+    {
+        // no extents: an empty file or the data is inlined into the inode
+        *offset = map->fm_mapped_extents ? map->fm_extents[0].fe_physical : 0;
+    }
+    else
+    {
+        int block = 0; // FIBMAP requires CAP_SYS_RAWIO
+        ok = ::ioctl(file, FIBMAP, &block) == 0;
+        *offset = static_cast<quint64>(block);
+    }
+
+    ::close(file);
+    return ok;
+#else
+    Q_UNUSED(path)
+    Q_UNUSED(offset)
+    return false;
+#endif
+}
@@ -0,0 +1,36 @@
+#ifndef IOSCHEDULER_H
+#define IOSCHEDULER_H
+
+#include <QStringList>
+#include <QVector>
+
+/// Orders file reads by their location on disk
+/// Files on rotational disks are read one at a time in ascending order of their first physical
+/// extent (FIEMAP, then FIBMAP, then inode number as an approximation), so the heads move in
+/// one direction instead of seeking back and forth; solid state devices get parallel reads
+class IoScheduler
+{
+public:
+    struct Device
+    {
+        quint64 id = 0; ///< st_dev
+        bool rotational = false;
+        int concurrency = 1; ///< The maximum number of files read in parallel
+        QVector<int> files; ///< Indexes in the scheduled list, in the reading order
+    };
+
+    /// Group the files by block device and sort them in the reading order
+    static QVector<Device> schedule(const QStringList& paths);
+
+    static const int mcRotationalConcurrency = 1;
+    static const int mcSolidStateConcurrency = 4;
+
+private:
+    /// Returns false for SSD and for unknown devices (network, virtual, etc.)
+    static bool isRotational(quint64 device);
+
+    /// The physical offset of the first file extent
+    static bool physicalOffset(const QString& path, quint64* offset);
+};
+
+#endif // IOSCHEDULER_H
@@ -1,15 +1,23 @@
 #include "mainwindow.h"
+#include "shardedscan.h"
 #include <QApplication>
 #include <QTextCodec>
 
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
-
 #ifdef Q_OS_UNIX
     QTextCodec::setCodecForLocale(QTextCodec::codecForName("UTF-8"));
 #endif
 
+    // worker processes of ShardedScan have no GUI
+    if (argc == 4 && qstrcmp(argv[1], ShardedScan::mcWorkerArgument) == 0)
+    {
+        QCoreApplication worker(argc, argv);
+        return ShardedScan::worker(QString::fromLocal8Bit(argv[2]), QByteArray(argv[3]).toInt());
+    }
+
+    QApplication a(argc, argv);
+
     a.setOrganizationName("sonnayasomnambula");
     a.setOrganizationDomain("sonnayasomnambula.org");
     a.setApplicationVersion("0.2");
@@ -12,6 +12,10 @@
 
 #include "abstractsettings.h"
 #include "fileinfomodel.h"
+#include "profiler.h"
+#include "profilerpanel.h"
+#include "progresspanel.h"
+#include "session.h"
 #include "settingsdialog.h"
 #include "statusmessage.h"
 #include "widgetlocker.h"
@@ -31,19 +35,112 @@ struct Settings : AbstractSettings
     {
         Tag<QString> command = "diff/command";
     } diff;
+
+    struct
+    {
+        Tag<bool> enabled = "images/enabled";
+        Tag<int> algorithm = "images/algorithm";
+        Tag<int> distance = "images/distance";
+    } images;
+
+    struct
+    {
+        Tag<bool> directories = "scan/directories";
+        Tag<bool> watch = "scan/watch";
+        Tag<bool> archives = "scan/archives";
+        Tag<int> workers = "scan/workers";
+        Tag<int> memoryBudget = "scan/memoryBudget";
+        Tag<qint64> treeHashThreshold = "scan/treeHashThreshold";
+        Tag<bool> validateSessions = "scan/validateSessions";
+    } scan;
+
+    struct
+    {
+        Tag<QStringList> include = "filter/include";
+        Tag<QStringList> exclude = "filter/exclude";
+        Tag<qint64> minSize = "filter/minSize";
+        Tag<qint64> maxSize = "filter/maxSize";
+        Tag<QDateTime> modifiedAfter = "filter/modifiedAfter";
+        Tag<QDateTime> modifiedBefore = "filter/modifiedBefore";
+        Tag<bool> sameFilesystem = "filter/sameFilesystem";
+    } filter;
+
+    struct
+    {
+        Tag<double> megabytesPerSecond = "throttle/megabytesPerSecond";
+        Tag<int> operationsPerSecond = "throttle/operationsPerSecond";
+        Tag<int> priority = "throttle/priority";
+        Tag<bool> adaptive = "throttle/adaptive";
+    } throttle;
+
+    ScanOptions scanOptions() const
+    {
+        ScanOptions options;
+        options.images = images.enabled(options.images);
+        options.imageAlgorithm = static_cast<ImageHash::Algorithm>(images.algorithm(options.imageAlgorithm));
+        options.imageDistance = images.distance(options.imageDistance);
+        options.directories = scan.directories(options.directories);
+        options.watch = scan.watch(options.watch);
+        options.archives = scan.archives(options.archives);
+        options.workers = scan.workers(options.workers);
+        options.memoryBudget = scan.memoryBudget(options.memoryBudget);
+        options.treeHashThreshold = scan.treeHashThreshold(options.treeHashThreshold);
+        options.validateSessions = scan.validateSessions(options.validateSessions);
+        options.filter.include = filter.include(options.filter.include);
+        options.filter.exclude = filter.exclude(options.filter.exclude);
+        options.filter.minSize = filter.minSize(options.filter.minSize);
+        options.filter.maxSize = filter.maxSize(options.filter.maxSize);
+        options.filter.modifiedAfter = filter.modifiedAfter(options.filter.modifiedAfter);
+        options.filter.modifiedBefore = filter.modifiedBefore(options.filter.modifiedBefore);
+        options.filter.sameFilesystem = filter.sameFilesystem(options.filter.sameFilesystem);
+        options.throttle.megabytesPerSecond = throttle.megabytesPerSecond(options.throttle.megabytesPerSecond);
+        options.throttle.operationsPerSecond = throttle.operationsPerSecond(options.throttle.operationsPerSecond);
+        options.throttle.priority = static_cast<Throttle::Priority>(throttle.priority(options.throttle.priority));
+        options.throttle.adaptive = throttle.adaptive(options.throttle.adaptive);
+        return options;
+    }
+
+    void saveScanOptions(const ScanOptions& options)
+    {
+        images.enabled.save(options.images);
+        images.algorithm.save(static_cast<int>(options.imageAlgorithm));
+        images.distance.save(options.imageDistance);
+        scan.directories.save(options.directories);
+        scan.watch.save(options.watch);
+        scan.archives.save(options.archives);
+        scan.workers.save(options.workers);
+        scan.memoryBudget.save(options.memoryBudget);
+        scan.treeHashThreshold.save(options.treeHashThreshold);
+        scan.validateSessions.save(options.validateSessions);
+        filter.include.save(options.filter.include);
+        filter.exclude.save(options.filter.exclude);
+        filter.minSize.save(options.filter.minSize);
+        filter.maxSize.save(options.filter.maxSize);
+        filter.modifiedAfter.save(options.filter.modifiedAfter);
+        filter.modifiedBefore.save(options.filter.modifiedBefore);
+        filter.sameFilesystem.save(options.filter.sameFilesystem);
+        throttle.megabytesPerSecond.save(options.throttle.megabytesPerSecond);
+        throttle.operationsPerSecond.save(options.throttle.operationsPerSecond);
+        throttle.priority.save(static_cast<int>(options.throttle.priority));
+        throttle.adaptive.save(options.throttle.adaptive);
+    }
 };
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow)
+    ui(new Ui::MainWindow),
+    mProfilerPanel(new ProfilerPanel(this)),
+    mProgressPanel(new ProgressPanel(this))
 {
     ui->setupUi(this);
+    ui->statusBar->addPermanentWidget(mProgressPanel);
+    ui->statusBar->addPermanentWidget(mProfilerPanel);
     connect(ui->fileList, &FileList::doubleClicked, this, &MainWindow::on_actionEdit_triggered);
+    StatusMessage::setStatusBar(ui->statusBar);
 
     loadSettings();
     setupActions();
 
-    StatusMessage::setStatusBar(ui->statusBar);
     StatusMessage::show(tr("Drag'n'drop files or directories here"), StatusMessage::mcInfinite);
 }
 
@@ -52,8 +149,20 @@ void MainWindow::setupActions()
     ui->fileList->setContextMenuPolicy(Qt::ActionsContextMenu);
     ui->fileList->addAction(ui->actionEdit);
     ui->fileList->addAction(ui->actionRemove);
+    ui->fileList->addAction(ui->actionExpand);
     ui->fileList->addAction(ui->actionDiff);
 
+    // the settings stay available, the throttle limits are applied to the running scan;
+    // disabled actions do not react to their shortcuts either
+    connect(ui->fileList, &FileList::collectingChanged, [this](bool collecting) {
+        ui->actionAdd_files->setEnabled(!collecting);
+        ui->actionAdd_directory->setEnabled(!collecting);
+        ui->actionOpen_session->setEnabled(!collecting);
+        ui->actionAdd_reference->setEnabled(!collecting);
+        ui->actionClear_references->setEnabled(!collecting);
+        setActionsEnabled(!ui->fileList->selectionModel()->selectedRows().isEmpty());
+    });
+
     connect(ui->fileList->selectionModel(), &QItemSelectionModel::selectionChanged, [this]{
         setActionsEnabled(!ui->fileList->selectionModel()->selectedRows().isEmpty());
     });
@@ -62,10 +171,13 @@ void MainWindow::setupActions()
 
 void MainWindow::setActionsEnabled(bool enabled)
 {
-    ui->actionDelete_file->setEnabled(enabled);
+    // the list cannot be changed while a collection runs
+    const bool editable = enabled && !ui->fileList->isCollecting();
+    ui->actionDelete_file->setEnabled(editable);
     ui->actionDiff->setEnabled(enabled);
     ui->actionEdit->setEnabled(enabled);
-    ui->actionRemove->setEnabled(enabled);
+    ui->actionRemove->setEnabled(editable);
+    ui->actionExpand->setEnabled(editable);
 }
 
 MainWindow::~MainWindow()
@@ -75,6 +187,8 @@ MainWindow::~MainWindow()
 
 void MainWindow::closeEvent(QCloseEvent* e)
 {
+    // the application quits, so the nested event loop of the collection is left and waits for the collector
+    ui->fileList->cancel();
     storeSettings();
     QMainWindow::closeEvent(e);
 }
@@ -86,6 +200,8 @@ void MainWindow::loadSettings()
     settings.window.geometry.restore(this);
     settings.window.state.restore(this);
     settings.window.header.state.restore(ui->fileList->header());
+
+    ui->fileList->setOptions(settings.scanOptions());
 }
 
 void MainWindow::storeSettings()
@@ -107,17 +223,58 @@ void MainWindow::on_actionAdd_directory_triggered()
     ui->fileList->add({QFileDialog::getExistingDirectoryUrl(this)});
 }
 
+void MainWindow::on_actionAdd_reference_triggered()
+{
+    const auto url = QFileDialog::getExistingDirectoryUrl(this);
+    if (url.isEmpty())
+        return;
+
+    ui->fileList->addReferences({url});
+}
+
+void MainWindow::on_actionClear_references_triggered()
+{
+    ui->fileList->clearReferences();
+}
+
+void MainWindow::on_actionOpen_session_triggered()
+{
+    const auto fileName = QFileDialog::getOpenFileName(this, "", {}, sessionFilter());
+    if (!fileName.isEmpty())
+        ui->fileList->openSession(fileName);
+}
+
+void MainWindow::on_actionSave_session_triggered()
+{
+    auto fileName = QFileDialog::getSaveFileName(this, "", {}, sessionFilter());
+    if (fileName.isEmpty())
+        return;
+
+    if (QFileInfo(fileName).suffix().isEmpty())
+        fileName += QString(".") + Session::mcSuffix;
+
+    ui->fileList->saveSession(fileName);
+}
+
+QString MainWindow::sessionFilter()
+{
+    return tr("MultiDiff sessions (*.%1)").arg(Session::mcSuffix);
+}
+
 bool MainWindow::on_actionSettings_triggered()
 {
     Settings settings;
     SettingsDialog dialog;
 
     dialog.setDiffCommand(settings.diff.command());
+    dialog.setOptions(ui->fileList->options());
 
     if (dialog.exec() != QDialog::Accepted)
         return false;
 
     settings.diff.command.save(dialog.diffCommand());
+    settings.saveScanOptions(dialog.options());
+    ui->fileList->setOptions(dialog.options());
     return true;
 }
 
@@ -127,6 +284,12 @@ void MainWindow::on_actionRemove_triggered()
     StatusMessage::clear();
 }
 
+void MainWindow::on_actionExpand_triggered()
+{
+    ui->fileList->expandSelected();
+    StatusMessage::clear();
+}
+
 void MainWindow::on_actionDelete_file_triggered()
 {
     const auto selection = ui->fileList->selectionModel()->selectedRows();
@@ -140,6 +303,13 @@ void MainWindow::on_actionDelete_file_triggered()
     QMultiMap<QString, QModelIndex> removed; // path --> index
     for (auto& row: selection) {
         auto path = ui->fileList->fileInfo(row).absoluteFilePath();
+        if (ui->fileList->isArchiveMember(row)) {
+            QMessageBox::critical(
+                        this,
+                        tr("Remove files"),
+                        tr("'%1' is inside an archive and cannot be removed").arg(path));
+            break;
+        }
         if (removed.contains(path) || QFile(path).remove()) { // the list may contain duplicates
             removed.insert(path, row);
         } else {
@@ -174,6 +344,15 @@ void MainWindow::on_actionDiff_triggered()
 
     const auto f1(ui->fileList->fileInfo(selection[0]));
     const auto f2(ui->fileList->fileInfo(selection[1]));
+    for (int i: { 0, 1 })
+    {
+        if (ui->fileList->isArchiveMember(selection[i]))
+        {
+            StatusMessage::show(tr("'%1' is inside an archive").arg(ui->fileList->fileInfo(selection[i]).absoluteFilePath()));
+            return;
+        }
+    }
+
     constexpr qint64 halfMB= 512 * 1024;
     if (f1.size() + f2.size() > halfMB)
     {
@@ -224,12 +403,50 @@ void MainWindow::on_actionEdit_triggered()
     }
 
     const auto path = ui->fileList->fileInfo(selection.first()).absoluteFilePath();
+    if (ui->fileList->isArchiveMember(selection.first()))
+    {
+        StatusMessage::show(tr("'%1' is inside an archive").arg(path));
+        return;
+    }
+
     QDesktopServices::openUrl(QUrl::fromLocalFile(path));
 }
 
 void MainWindow::on_actionShow_duplicates_triggered()
 {
-    ui->fileList->selectNextDuplicates();
+    ui->fileList->selectNextDuplicates(FileInfoModel::eHash);
+}
+
+void MainWindow::on_actionShow_similar_images_triggered()
+{
+    ui->fileList->selectNextDuplicates(FileInfoModel::eSimilar);
+}
+
+void MainWindow::on_actionScan_statistics_toggled(bool checked)
+{
+    mProfilerPanel->setActive(checked);
+    ui->actionExport_statistics->setEnabled(checked);
+}
+
+void MainWindow::on_actionExport_statistics_triggered()
+{
+    const auto statistics = tr("Statistics (*.json)");
+    const auto trace = tr("Chrome trace (*.trace.json)");
+
+    QString filter = statistics;
+    const auto fileName = QFileDialog::getSaveFileName(this, "", {}, statistics + ";;" + trace, &filter);
+    if (fileName.isEmpty())
+        return;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) ||
+        file.write(filter == trace ? Profiler::toChromeTrace() : Profiler::toJson()) < 0)
+    {
+        QMessageBox::warning(this, "", tr("Unable to save '%1': %2").arg(fileName, file.errorString()));
+        return;
+    }
+
+    StatusMessage::show(tr("Statistics saved to '%1'").arg(fileName));
 }
 
 void MainWindow::on_actionAbout_Qt_triggered()
@@ -7,6 +7,9 @@ namespace Ui {
 class MainWindow;
 }
 
+class ProfilerPanel;
+class ProgressPanel;
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -18,12 +21,20 @@ public:
 private slots:
     void on_actionAdd_files_triggered();
     void on_actionAdd_directory_triggered();
+    void on_actionAdd_reference_triggered();
+    void on_actionClear_references_triggered();
+    void on_actionOpen_session_triggered();
+    void on_actionSave_session_triggered();
     bool on_actionSettings_triggered();
     void on_actionRemove_triggered();
+    void on_actionExpand_triggered();
     void on_actionDelete_file_triggered();
     void on_actionDiff_triggered();
     void on_actionEdit_triggered();
     void on_actionShow_duplicates_triggered();
+    void on_actionShow_similar_images_triggered();
+    void on_actionScan_statistics_toggled(bool checked);
+    void on_actionExport_statistics_triggered();
     void on_actionAbout_Qt_triggered();
     void on_actionAbout_triggered();
 
@@ -37,8 +48,11 @@ private:
     void setActionsEnabled(bool enabled);
 
     static QString humanReadableSize(quint64 bytes);
+    static QString sessionFilter();
 
     Ui::MainWindow *ui;
+    ProfilerPanel* mProfilerPanel = nullptr;
+    ProgressPanel* mProgressPanel = nullptr;
 };
 
 #endif // MAINWINDOW_H
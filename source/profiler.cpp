@@ -0,0 +1,293 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
+constexpr int Profiler::mcHistogramSize;
+
+std::atomic<bool> Profiler::mEnabled { false };
+std::atomic<quint64> Profiler::mFiles { 0 };
+std::atomic<quint64> Profiler::mBytes { 0 };
+std::atomic<int> Profiler::mQueueDepth { 0 };
+
+namespace {
+
+struct Event
+{
+    Profiler::Stage stage;
+    qint64 start;
+    qint64 duration;
+};
+
+/// Collected by one thread; counters are atomic to be read by the GUI while the thread works
+struct ThreadData
+{
+    int id = 0;
+    QString name;
+    std::array<std::atomic<qint64>, Profiler::StageCount> nsecs {};
+    QMutex mutex; ///< Guards events
+    std::vector<Event> events;
+};
+
+constexpr size_t cMaxEvents = 1 << 20; ///< Per thread, to limit the memory used by long scans
+
+std::atomic<qint64> gStart { 0 };
+std::array<std::atomic<quint64>, Profiler::mcHistogramSize> gStatHistogram {};
+
+/// The data of the threads which have exited, merged so the memory does not grow with every new thread
+struct Exited
+{
+    std::array<qint64, Profiler::StageCount> nsecs {};
+    std::vector<std::pair<int, Event>> events; ///< Thread id, event; cMaxEvents in total
+    QHash<int, QString> names; ///< Thread id --> name, for the threads with events only
+};
+
+QMutex gThreadsMutex; ///< Guards gThreads, gExited and gLastId
+std::vector<ThreadData*> gThreads; ///< Running threads
+Exited gExited;
+int gLastId = 0;
+
+/// Owned by its thread, merges the data into gExited when the thread exits
+class ThreadOwner
+{
+public:
+    ThreadOwner() : mData(std::make_unique<ThreadData>())
+    {
+        auto qthread = QThread::currentThread();
+        mData->name = qthread && !qthread->objectName().isEmpty() ? qthread->objectName() : QString();
+
+        QMutexLocker lock(&gThreadsMutex);
+        mData->id = ++gLastId;
+        if (mData->name.isEmpty())
+            mData->name = QString("Thread %1").arg(mData->id);
+        gThreads.push_back(mData.get());
+    }
+
+    ~ThreadOwner()
+    {
+        QMutexLocker lock(&gThreadsMutex);
+        gThreads.erase(std::find(gThreads.begin(), gThreads.end(), mData.get()));
+
+        for (int stage = 0; stage < Profiler::StageCount; ++stage)
+            gExited.nsecs[stage] += mData->nsecs[stage].load();
+
+        // only this thread records its events, so mData->mutex is not needed
+        const auto kept = std::min(mData->events.size(), cMaxEvents - std::min(cMaxEvents, gExited.events.size()));
+        if (kept > 0)
+            gExited.names.insert(mData->id, mData->name);
+        for (size_t i = 0; i < kept; ++i)
+            gExited.events.emplace_back(mData->id, mData->events[i]);
+    }
+
+    ThreadData& data() { return *mData; }
+
+private:
+    std::unique_ptr<ThreadData> mData;
+};
+
+ThreadData& currentThread()
+{
+    thread_local ThreadOwner owner;
+    return owner.data();
+}
+
+} // namespace
+
+qint64 Profiler::now()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::setEnabled(bool enabled)
+{
+    if (enabled)
+        reset();
+    mEnabled.store(enabled);
+}
+
+void Profiler::reset()
+{
+    gStart.store(now());
+    mFiles.store(0);
+    mBytes.store(0);
+    mQueueDepth.store(0);
+    for (auto& bucket: gStatHistogram)
+        bucket.store(0);
+
+    QMutexLocker lock(&gThreadsMutex);
+    for (auto& thread: gThreads)
+    {
+        for (auto& nsecs: thread->nsecs)
+            nsecs.store(0);
+
+        QMutexLocker eventsLock(&thread->mutex);
+        thread->events.clear();
+    }
+
+    gExited = Exited();
+}
+
+void Profiler::record(Stage stage, qint64 start, qint64 duration)
+{
+    auto& thread = currentThread();
+    thread.nsecs[stage].fetch_add(duration, std::memory_order_relaxed);
+
+    if (stage == eStat)
+    {
+        int bucket = 0;
+        for (qint64 us = duration / 1000; us > 1 && bucket < mcHistogramSize - 1; us >>= 1)
+            ++bucket;
+        gStatHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    QMutexLocker lock(&thread.mutex);
+    if (thread.events.size() < cMaxEvents)
+        thread.events.push_back({ stage, start, duration });
+}
+
+quint64 Profiler::Snapshot::statPercentile(double p) const
+{
+    quint64 total = 0;
+    for (auto count: statHistogram)
+        total += count;
+    if (total == 0)
+        return 0;
+
+    quint64 sum = 0;
+    for (int i = 0; i < mcHistogramSize; ++i)
+    {
+        sum += statHistogram[i];
+        if (sum >= total * p)
+            return quint64(2) << i;
+    }
+
+    return quint64(2) << (mcHistogramSize - 1);
+}
+
+Profiler::Snapshot Profiler::snapshot()
+{
+    Snapshot snapshot;
+    snapshot.elapsed = now() - gStart.load();
+    snapshot.files = mFiles.load();
+    snapshot.bytes = mBytes.load();
+    snapshot.queueDepth = mQueueDepth.load();
+    for (int i = 0; i < mcHistogramSize; ++i)
+        snapshot.statHistogram[i] = gStatHistogram[i].load();
+
+    QMutexLocker lock(&gThreadsMutex);
+    for (const auto& thread: gThreads)
+    {
+        ThreadStats stats { thread->id, thread->name, {} };
+        for (int stage = 0; stage < StageCount; ++stage)
+            stats.nsecs[stage] = thread->nsecs[stage].load();
+        snapshot.threads.append(stats);
+    }
+
+    if (std::any_of(gExited.nsecs.cbegin(), gExited.nsecs.cend(), [](qint64 nsecs) { return nsecs > 0; }))
+        snapshot.threads.append({ 0, QObject::tr("Exited threads"), gExited.nsecs });
+
+    return snapshot;
+}
+
+QByteArray Profiler::toJson()
+{
+    const auto s = snapshot();
+    const double seconds = s.elapsed / 1e9;
+
+    QJsonArray histogram;
+    for (auto count: s.statHistogram)
+        histogram.append(static_cast<qint64>(count));
+
+    QJsonArray threads;
+    for (const auto& thread: s.threads)
+    {
+        QJsonObject stages;
+        for (int stage = 0; stage < StageCount; ++stage)
+            stages.insert(stageName(static_cast<Stage>(stage)), thread.nsecs[stage] / 1e9);
+        threads.append(QJsonObject { { "id", thread.id }, { "name", thread.name }, { "seconds", stages } });
+    }
+
+    const QJsonObject root {
+        { "elapsedSeconds", seconds },
+        { "files", static_cast<qint64>(s.files) },
+        { "bytes", static_cast<qint64>(s.bytes) },
+        { "filesPerSecond", seconds > 0 ? s.files / seconds : 0. },
+        { "megabytesPerSecond", seconds > 0 ? s.bytes / seconds / (1024 * 1024) : 0. },
+        { "statLatencyHistogramMicroseconds", histogram },
+        { "threads", threads },
+    };
+
+    return QJsonDocument(root).toJson();
+}
+
+QByteArray Profiler::toChromeTrace()
+{
+    const qint64 start = gStart.load();
+
+    QJsonArray events;
+
+    QMutexLocker lock(&gThreadsMutex);
+    for (const auto& thread: gThreads)
+    {
+        events.append(QJsonObject {
+            { "name", "thread_name" }, { "ph", "M" }, { "pid", 1 }, { "tid", thread->id },
+            { "args", QJsonObject { { "name", thread->name } } },
+        });
+
+        QMutexLocker eventsLock(&thread->mutex);
+        for (const auto& event: thread->events)
+        {
+            // complete events, timestamps in microseconds
+            events.append(QJsonObject {
+                { "name", stageName(event.stage) }, { "cat", "scan" }, { "ph", "X" },
+                { "pid", 1 }, { "tid", thread->id },
+                { "ts", (event.start - start) / 1000. }, { "dur", event.duration / 1000. },
+            });
+        }
+    }
+
+    for (auto name = gExited.names.cbegin(); name != gExited.names.cend(); ++name)
+    {
+        events.append(QJsonObject {
+            { "name", "thread_name" }, { "ph", "M" }, { "pid", 1 }, { "tid", name.key() },
+            { "args", QJsonObject { { "name", name.value() } } },
+        });
+    }
+
+    for (const auto& exited: gExited.events)
+    {
+        const auto& event = exited.second;
+        events.append(QJsonObject {
+            { "name", stageName(event.stage) }, { "cat", "scan" }, { "ph", "X" },
+            { "pid", 1 }, { "tid", exited.first },
+            { "ts", (event.start - start) / 1000. }, { "dur", event.duration / 1000. },
+        });
+    }
+
+    return QJsonDocument(QJsonObject { { "traceEvents", events }, { "displayTimeUnit", "ms" } }).toJson(QJsonDocument::Compact);
+}
+
+QString Profiler::stageName(Stage stage)
+{
+    switch (stage)
+    {
+        case eTraverse: return "traverse";
+        case eStat:     return "stat";
+        case eRead:     return "read";
+        case eHash:     return "hash";
+        case eImage:    return "image";
+        case eModel:    return "model";
+        default:        return {};
+    }
+}
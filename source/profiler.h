@@ -0,0 +1,96 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <array>
+#include <atomic>
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+/// Per-stage scan instrumentation: throughput counters, stat latency histogram,
+/// time per stage per thread and trace events
+/// When disabled, each probe costs a single relaxed atomic load
+class Profiler
+{
+public:
+    enum Stage { eTraverse, eStat, eRead, eHash, eImage, eModel, StageCount };
+
+    static bool isEnabled() { return mEnabled.load(std::memory_order_relaxed); }
+
+    /// Enabling resets all the counters
+    static void setEnabled(bool enabled);
+    static void reset();
+
+    /// Measures the time from construction to destruction as the given stage
+    class Scope
+    {
+    public:
+        explicit Scope(Stage stage) : mStage(stage), mStart(isEnabled() ? now() : -1) {}
+        ~Scope() { if (mStart >= 0) record(mStage, mStart, now() - mStart); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator =(const Scope&) = delete;
+
+    private:
+        const Stage mStage;
+        const qint64 mStart;
+    };
+
+    /// The file is processed completely
+    static void addFile(qint64 bytes)
+    {
+        if (!isEnabled()) return;
+        mFiles.fetch_add(1, std::memory_order_relaxed);
+        mBytes.fetch_add(static_cast<quint64>(bytes), std::memory_order_relaxed);
+    }
+
+    /// The number of files waiting for processing
+    static void setQueueDepth(int depth)
+    {
+        if (isEnabled()) mQueueDepth.store(depth, std::memory_order_relaxed);
+    }
+
+    static constexpr int mcHistogramSize = 32; ///< Bucket i holds latencies in [2^i, 2^(i+1)) microseconds
+
+    struct ThreadStats
+    {
+        int id; ///< 0 for the totals of the threads which have exited
+        QString name;
+        std::array<qint64, StageCount> nsecs; ///< Time per stage
+    };
+
+    struct Snapshot
+    {
+        qint64 elapsed = 0; ///< Nanoseconds since the profiler was enabled
+        quint64 files = 0;
+        quint64 bytes = 0;
+        int queueDepth = 0;
+        std::array<quint64, mcHistogramSize> statHistogram {};
+        QVector<ThreadStats> threads;
+
+        /// Approximate stat latency percentile in microseconds (upper bound of the bucket)
+        quint64 statPercentile(double p) const;
+    };
+
+    static Snapshot snapshot();
+
+    /// Counters, histogram and per-thread stage times
+    static QByteArray toJson();
+
+    /// Trace Event Format, load with chrome://tracing or Perfetto
+    static QByteArray toChromeTrace();
+
+    static QString stageName(Stage stage);
+
+private:
+    static qint64 now();
+    static void record(Stage stage, qint64 start, qint64 duration);
+
+    static std::atomic<bool> mEnabled;
+    static std::atomic<quint64> mFiles;
+    static std::atomic<quint64> mBytes;
+    static std::atomic<int> mQueueDepth;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,60 @@
+#include "profilerpanel.h"
+
+ProfilerPanel::ProfilerPanel(QWidget* parent) :
+    QLabel(parent)
+{
+    mTimer.setInterval(500);
+    connect(&mTimer, &QTimer::timeout, this, &ProfilerPanel::refresh);
+    hide();
+}
+
+void ProfilerPanel::setActive(bool active)
+{
+    Profiler::setEnabled(active);
+    mLast = Profiler::snapshot();
+
+    setVisible(active);
+    if (active)
+    {
+        mTimer.start();
+        refresh();
+    }
+    else
+    {
+        mTimer.stop();
+    }
+}
+
+void ProfilerPanel::refresh()
+{
+    const auto current = Profiler::snapshot();
+    const double seconds = (current.elapsed - mLast.elapsed) / 1e9;
+    if (seconds <= 0)
+        return;
+
+    const double files = (current.files - mLast.files) / seconds;
+    const double megabytes = (current.bytes - mLast.bytes) / seconds / (1024 * 1024);
+
+    setText(tr("%1 files/s, %2 MB/s, stat p50/p99 %3/%4 us, queue %5")
+            .arg(files, 0, 'f', 0)
+            .arg(megabytes, 0, 'f', 1)
+            .arg(current.statPercentile(0.5))
+            .arg(current.statPercentile(0.99))
+            .arg(current.queueDepth));
+
+    // time per stage per thread, since the profiler was enabled
+    QStringList lines;
+    for (const auto& thread: current.threads)
+    {
+        QStringList stages;
+        for (int stage = 0; stage < Profiler::StageCount; ++stage)
+            if (thread.nsecs[stage] > 0)
+                stages.append(QString("%1 %2 s").arg(Profiler::stageName(static_cast<Profiler::Stage>(stage)))
+                              .arg(thread.nsecs[stage] / 1e9, 0, 'f', 2));
+        if (!stages.isEmpty())
+            lines.append(thread.name + ": " + stages.join(", "));
+    }
+    setToolTip(lines.join('\n'));
+
+    mLast = current;
+}
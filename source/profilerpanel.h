@@ -0,0 +1,28 @@
+#ifndef PROFILERPANEL_H
+#define PROFILERPANEL_H
+
+#include <QLabel>
+#include <QTimer>
+
+#include "profiler.h"
+
+/// Status bar widget with live Profiler counters
+/// The tooltip shows the time per stage for each thread
+class ProfilerPanel : public QLabel
+{
+    Q_OBJECT
+
+public:
+    explicit ProfilerPanel(QWidget* parent = nullptr);
+
+    /// Enables the profiler and shows the panel
+    void setActive(bool active);
+
+private:
+    void refresh();
+
+    QTimer mTimer;
+    Profiler::Snapshot mLast; ///< Rates are calculated between two updates
+};
+
+#endif // PROFILERPANEL_H
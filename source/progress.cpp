@@ -0,0 +1,78 @@
+#include "progress.h"
+
+#include <chrono>
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QObject>
+
+std::atomic<int> Progress::mStage { eIdle };
+std::atomic<qint64> Progress::mFiles { 0 };
+std::atomic<qint64> Progress::mTotalFiles { 0 };
+std::atomic<qint64> Progress::mBytes { 0 };
+std::atomic<qint64> Progress::mTotalBytes { 0 };
+std::atomic<qint64> Progress::mStart { 0 };
+std::atomic<bool> Progress::mSampleRequested { false };
+
+namespace {
+
+QMutex gPathMutex;
+QString gPath; ///< Guarded by gPathMutex
+
+qint64 now()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+void Progress::begin(Stage stage, qint64 totalFiles, qint64 totalBytes)
+{
+    mFiles.store(0);
+    mBytes.store(0);
+    mTotalFiles.store(totalFiles);
+    mTotalBytes.store(totalBytes);
+    mStart.store(now());
+    setPath({});
+    mStage.store(stage);
+}
+
+Progress::Snapshot Progress::snapshot()
+{
+    Snapshot snapshot;
+    snapshot.stage = static_cast<Stage>(mStage.load());
+    snapshot.files = mFiles.load(std::memory_order_relaxed);
+    snapshot.totalFiles = mTotalFiles.load(std::memory_order_relaxed);
+    snapshot.bytes = mBytes.load(std::memory_order_relaxed);
+    snapshot.totalBytes = mTotalBytes.load(std::memory_order_relaxed);
+    snapshot.elapsed = now() - mStart.load(std::memory_order_relaxed);
+
+    {
+        QMutexLocker lock(&gPathMutex);
+        snapshot.path = gPath;
+    }
+    mSampleRequested.store(true);
+
+    return snapshot;
+}
+
+QString Progress::stageName(Stage stage)
+{
+    switch (stage)
+    {
+    case eIdle: return {};
+    case eList: return QObject::tr("List files");
+    case eHash: return QObject::tr("Calculate hashes");
+    case eArchives: return QObject::tr("Read archives");
+    case eImages: return QObject::tr("Calculate image hashes");
+    case StageCount: break;
+    }
+    return {};
+}
+
+void Progress::setPath(const QString& path)
+{
+    QMutexLocker lock(&gPathMutex);
+    gPath = path;
+}
@@ -0,0 +1,64 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+
+#include <QString>
+
+/// Progress of the running collection
+/// The collecting threads only update relaxed atomic counters; the GUI polls snapshot() at its own
+/// frame rate (see ProgressPanel), so nothing on the hot path processes events or repaints
+class Progress
+{
+public:
+    enum Stage { eIdle, eList, eHash, eArchives, eImages, StageCount };
+
+    /// Start the stage; the counters are reset, totals of 0 mean unknown
+    static void begin(Stage stage, qint64 totalFiles = 0, qint64 totalBytes = 0);
+
+    /// The collection is finished
+    static void end() { begin(eIdle); }
+
+    /// The files are processed
+    static void add(qint64 files, qint64 bytes = 0)
+    {
+        mFiles.fetch_add(files, std::memory_order_relaxed);
+        mBytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    /// Report the file being processed; the path is copied only if a snapshot was taken since the last copy
+    static void sample(const QString& path)
+    {
+        if (mSampleRequested.load(std::memory_order_relaxed) && mSampleRequested.exchange(false))
+            setPath(path);
+    }
+
+    struct Snapshot
+    {
+        Stage stage = eIdle;
+        qint64 files = 0;
+        qint64 totalFiles = 0; ///< 0 if unknown
+        qint64 bytes = 0;
+        qint64 totalBytes = 0; ///< 0 if unknown
+        qint64 elapsed = 0; ///< ns since the stage began
+        QString path; ///< A recently processed file
+    };
+
+    /// Thread-safe; requests a new path sample
+    static Snapshot snapshot();
+
+    static QString stageName(Stage stage);
+
+private:
+    static void setPath(const QString& path);
+
+    static std::atomic<int> mStage;
+    static std::atomic<qint64> mFiles;
+    static std::atomic<qint64> mTotalFiles;
+    static std::atomic<qint64> mBytes;
+    static std::atomic<qint64> mTotalBytes;
+    static std::atomic<qint64> mStart; ///< ns, steady clock
+    static std::atomic<bool> mSampleRequested;
+};
+
+#endif // PROGRESS_H
@@ -0,0 +1,67 @@
+#include "progresspanel.h"
+
+#include <algorithm>
+
+#include <QLocale>
+
+ProgressPanel::ProgressPanel(QWidget* parent) :
+    QProgressBar(parent)
+{
+    setTextVisible(true);
+    setMinimumWidth(320);
+
+    mTimer.setInterval(mcFrameInterval);
+    connect(&mTimer, &QTimer::timeout, this, &ProgressPanel::refresh);
+    mTimer.start();
+    hide();
+}
+
+void ProgressPanel::refresh()
+{
+    const auto current = Progress::snapshot();
+    if (current.stage == Progress::eIdle)
+    {
+        hide();
+        return;
+    }
+
+    // the bytes give a better estimate when known, a few big files take longer than many small ones
+    const bool byBytes = current.totalBytes > 0;
+    const qint64 done = byBytes ? current.bytes : current.files;
+    const qint64 total = byBytes ? current.totalBytes : current.totalFiles;
+
+    const QLocale locale;
+    auto text = Progress::stageName(current.stage) + ": " + locale.toString(current.files);
+    if (current.totalFiles > 0)
+        text += "/" + locale.toString(current.totalFiles);
+    if (current.bytes > 0)
+        text += ", " + locale.formattedDataSize(current.bytes);
+
+    if (total > 0)
+    {
+        setRange(0, 1000);
+        setValue(static_cast<int>(std::min<qint64>(done, total) * 1000 / total));
+
+        // after a second, the rate is stable enough
+        const double seconds = current.elapsed / 1e9;
+        if (done > 0 && seconds >= 1)
+            text += ", " + tr("%1 left").arg(formatDuration(static_cast<qint64>(seconds * (total - done) / done)));
+    }
+    else
+    {
+        setRange(0, 0); // busy indicator
+    }
+
+    setFormat(text);
+    setToolTip(current.path);
+    show();
+}
+
+QString ProgressPanel::formatDuration(qint64 seconds)
+{
+    const auto minutes = seconds / 60;
+    if (minutes < 60)
+        return QString("%1:%2").arg(minutes).arg(seconds % 60, 2, 10, QChar('0'));
+
+    return QString("%1:%2:%3").arg(minutes / 60).arg(minutes % 60, 2, 10, QChar('0')).arg(seconds % 60, 2, 10, QChar('0'));
+}
@@ -0,0 +1,29 @@
+#ifndef PROGRESSPANEL_H
+#define PROGRESSPANEL_H
+
+#include <QProgressBar>
+#include <QTimer>
+
+#include "progress.h"
+
+/// Status bar widget polling Progress at a fixed frame rate while a collection runs
+/// Shows the stage, the counters and the estimated time left; the tooltip shows a file being processed
+class ProgressPanel : public QProgressBar
+{
+    Q_OBJECT
+
+public:
+    explicit ProgressPanel(QWidget* parent = nullptr);
+
+    static const int mcFrameInterval = 100; ///< ms between polls
+
+private:
+    void refresh();
+
+    /// Like "1:05", "1:02:05"
+    static QString formatDuration(qint64 seconds);
+
+    QTimer mTimer;
+};
+
+#endif // PROGRESSPANEL_H
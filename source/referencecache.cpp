@@ -0,0 +1,70 @@
+#include "referencecache.h"
+
+#include <algorithm>
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QStandardPaths>
+
+#include "session.h"
+
+namespace {
+
+/// The same roots in any order give the same file
+QString cacheFileName(QStringList roots)
+{
+    std::sort(roots.begin(), roots.end());
+    const auto key = QCryptographicHash::hash(roots.join('\n').toUtf8(), QCryptographicHash::Sha1).toHex();
+    const auto dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/references";
+    return QString("%1/%2.%3").arg(dir, QString::fromLatin1(key), Session::mcSuffix);
+}
+
+} // namespace
+
+ReferenceCache::ReferenceCache(const QStringList& roots)
+    : mRoots(roots)
+    , mFileName(cacheFileName(roots))
+{
+    Session session;
+    if (!session.load(mFileName))
+        return;
+
+    for (const auto& item: qAsConst(session.items))
+        mLoaded.insert(item.fileInfo.absoluteFilePath(), item);
+}
+
+bool ReferenceCache::find(const QString& path, qint64 size, const QDateTime& lastModified, FileItem* item)
+{
+    const auto i = mLoaded.constFind(path);
+    if (i == mLoaded.cend() || i->size != size || i->lastModified != lastModified)
+        return false;
+
+    *item = *i;
+    mKept.insert(path, *i);
+    return true;
+}
+
+void ReferenceCache::insert(const FileItem& item)
+{
+    mKept.insert(item.fileInfo.absoluteFilePath(), item);
+}
+
+bool ReferenceCache::save(QString* warning) const
+{
+    if (!QDir().mkpath(QFileInfo(mFileName).absolutePath()))
+    {
+        *warning = QObject::tr("Unable to create the cache directory for '%1'").arg(mFileName);
+        return false;
+    }
+
+    Session session;
+    session.items = mKept.values();
+    session.roots = mRoots;
+    if (!session.save(mFileName))
+    {
+        *warning = QObject::tr("Unable to save the reference hashes to '%1': %2").arg(mFileName, session.errorString());
+        return false;
+    }
+
+    return true;
+}
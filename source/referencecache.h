@@ -0,0 +1,35 @@
+#ifndef REFERENCECACHE_H
+#define REFERENCECACHE_H
+
+#include <QHash>
+#include <QStringList>
+
+#include "fileinfomodel.h"
+
+/// Hashes of the reference files kept between comparisons, see Collector::compare
+/// There is a session file per set of reference roots in the application cache directory;
+/// an entry is valid while the file has the same size and modification time
+class ReferenceCache
+{
+public:
+    /// Load the cache of the given reference roots, a missing or broken file means an empty cache
+    explicit ReferenceCache(const QStringList& roots);
+
+    /// Take the cached hash of the file if it is not modified since; the entry is kept on save
+    bool find(const QString& path, qint64 size, const QDateTime& lastModified, FileItem* item);
+
+    /// Add or replace the entry of a freshly hashed file
+    void insert(const FileItem& item);
+
+    /// Write the found and inserted entries; the entries of the files not found are dropped
+    /// Returns false and sets the localized warning on failure
+    bool save(QString* warning) const;
+
+private:
+    const QStringList mRoots;
+    const QString mFileName;
+    QHash<QString, FileItem> mLoaded; ///< Absolute path --> item
+    QHash<QString, FileItem> mKept; ///< Absolute path --> item
+};
+
+#endif // REFERENCECACHE_H
@@ -0,0 +1,184 @@
+#include "scanfilter.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QFile>
+#include <QObject>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#else
+#include <QHash>
+#include <QStorageInfo>
+#endif
+
+const char* const ScanFilter::mcRegExpPrefix = "re:";
+
+ScanFilter::ScanFilter(const Rules& rules) :
+    mRules(rules),
+    mInclude(compile(rules.include, false)),
+    mExclude(compile(rules.exclude, true))
+{
+}
+
+bool ScanFilter::acceptsDir(const QString& relativePath) const
+{
+    return !mExclude.matches(relativePath);
+}
+
+bool ScanFilter::acceptsFile(const QString& relativePath) const
+{
+    if (!mInclude.isEmpty() && !mInclude.matches(relativePath))
+        return false;
+
+    return !mExclude.matches(relativePath);
+}
+
+bool ScanFilter::needsStat() const
+{
+    return mRules.minSize > 0 || mRules.maxSize > 0 || mRules.modifiedAfter.isValid() || mRules.modifiedBefore.isValid();
+}
+
+bool ScanFilter::acceptsStat(qint64 size, const QDateTime& lastModified) const
+{
+    if (size < mRules.minSize)
+        return false;
+    if (mRules.maxSize > 0 && size > mRules.maxSize)
+        return false;
+    if (mRules.modifiedAfter.isValid() && lastModified < mRules.modifiedAfter)
+        return false;
+    if (mRules.modifiedBefore.isValid() && lastModified > mRules.modifiedBefore)
+        return false;
+    return true;
+}
+
+bool ScanFilter::device(const QString& path, quint64* id)
+{
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(path).constData(), &st) != 0)
+        return false;
+    *id = st.st_dev;
+    return true;
+#else
+    const QStorageInfo storage(path);
+    if (!storage.isValid())
+        return false;
+    *id = qHash(storage.rootPath());
+    return true;
+#endif
+}
+
+bool ScanFilter::Matcher::matches(const QString& path) const
+{
+    if (!globs.pattern().isEmpty() && globs.match(path).hasMatch())
+        return true;
+
+    return std::any_of(expressions.cbegin(), expressions.cend(), [&path](const QRegularExpression& expression) {
+        return expression.match(path).hasMatch();
+    });
+}
+
+ScanFilter::Matcher ScanFilter::compile(const QStringList& patterns, bool ancestors)
+{
+    const QString end = ancestors ? "(?:/|$)" : "$";
+
+    Matcher matcher;
+    QStringList alternatives;
+    for (const auto& pattern: patterns)
+    {
+        if (pattern.isEmpty())
+            continue;
+
+        const bool isRegExp = pattern.startsWith(mcRegExpPrefix);
+        QString body;
+        if (isRegExp)
+        {
+            body = pattern.mid(static_cast<int>(strlen(mcRegExpPrefix)));
+        }
+        else
+        {
+            auto glob = pattern;
+            while (glob.endsWith('/')) // "build/" means the same as "build"
+                glob.chop(1);
+
+            const bool anchored = glob.startsWith('/');
+            body = (anchored ? "^" : "(?:^|/)") + fromGlob(anchored ? glob.mid(1) : glob) + end;
+        }
+
+        // check each pattern separately, so a typo does not disable the whole list
+        QRegularExpression single(body);
+        if (!single.isValid())
+        {
+            mErrors.append(QObject::tr("Invalid filter pattern '%1': %2").arg(pattern, single.errorString()));
+            continue;
+        }
+
+        // globs have no capture groups, so only they can share an expression
+        if (isRegExp)
+        {
+            single.optimize();
+            matcher.expressions.append(single);
+        }
+        else
+        {
+            alternatives.append("(?:" + body + ')');
+        }
+    }
+
+    if (!alternatives.isEmpty())
+    {
+        matcher.globs.setPattern(alternatives.join('|'));
+        matcher.globs.optimize();
+    }
+    return matcher;
+}
+
+QString ScanFilter::fromGlob(const QString& glob)
+{
+    QString result;
+    for (int i = 0; i < glob.size(); ++i)
+    {
+        const QChar c = glob[i];
+        if (c == '*')
+        {
+            if (i + 1 < glob.size() && glob[i + 1] == '*')
+            {
+                // "**/" also matches no directories at all
+                const bool slash = i + 2 < glob.size() && glob[i + 2] == '/';
+                result += slash ? "(?:.*/)?" : ".*";
+                i += slash ? 2 : 1;
+            }
+            else
+            {
+                result += "[^/]*";
+            }
+        }
+        else if (c == '?')
+        {
+            result += "[^/]";
+        }
+        else if (c == '[')
+        {
+            const int close = glob.indexOf(']', i + 2); // "[]]" has ']' inside
+            if (close < 0)
+            {
+                result += "\\[";
+                continue;
+            }
+
+            auto set = glob.mid(i + 1, close - i - 1);
+            if (set.startsWith('!'))
+                set[0] = '^';
+            set.replace("\\", "\\\\");
+            result += '[' + set + ']';
+            i = close;
+        }
+        else
+        {
+            result += QRegularExpression::escape(QString(c));
+        }
+    }
+    return result;
+}
@@ -0,0 +1,77 @@
+#ifndef SCANFILTER_H
+#define SCANFILTER_H
+
+#include <QDateTime>
+#include <QRegularExpression>
+#include <QStringList>
+#include <QVector>
+
+/// Decides which files of a scanned directory are collected
+/// Patterns are matched against the path relative to the scanned directory, like in .gitignore:
+/// a glob without '/' matches any path component ("node_modules", "*.tmp"), a glob with '/'
+/// matches from any component boundary, or from the scanned directory if it starts with '/';
+/// '*' and '?' do not cross '/', '**' does; patterns with the "re:" prefix are regular expressions
+/// The globs of a list are compiled into a single regular expression once; each "re:" pattern
+/// stays a separate expression, so its capture groups and backreferences keep their numbers
+class ScanFilter
+{
+public:
+    struct Rules
+    {
+        QStringList include; ///< Files to collect, all files if empty
+        QStringList exclude; ///< Files and directories to skip; excluded directories are not descended into
+        qint64 minSize = 0;
+        qint64 maxSize = 0; ///< 0 means unlimited
+        QDateTime modifiedAfter; ///< Invalid means unlimited
+        QDateTime modifiedBefore; ///< Invalid means unlimited
+        bool sameFilesystem = false; ///< Do not cross mount points of the scanned directory
+    };
+
+    explicit ScanFilter(const Rules& rules = {});
+
+    /// The directory should be descended into; no stat is required
+    bool acceptsDir(const QString& relativePath) const;
+
+    /// The file should be collected if acceptsStat also agrees; no stat is required
+    /// Files in excluded directories are rejected too
+    bool acceptsFile(const QString& relativePath) const;
+
+    /// There are size or modification time limits, so the files have to be stat'ed
+    bool needsStat() const;
+    bool acceptsStat(qint64 size, const QDateTime& lastModified) const;
+
+    bool sameFilesystem() const { return mRules.sameFilesystem; }
+
+    /// Localized messages about the invalid patterns, which are ignored
+    const QStringList& errors() const { return mErrors; }
+
+    /// The file system identifier of the path (st_dev), false if the path is inaccessible
+    static bool device(const QString& path, quint64* id);
+
+    static const char* const mcRegExpPrefix;
+
+private:
+    /// The compiled patterns of one list
+    struct Matcher
+    {
+        QRegularExpression globs; ///< All the globs combined, empty if there are none
+        QVector<QRegularExpression> expressions; ///< The "re:" patterns
+
+        bool isEmpty() const { return globs.pattern().isEmpty() && expressions.isEmpty(); }
+        bool matches(const QString& path) const;
+    };
+
+    /// Combine the globs into one expression; the match ends at the path end
+    /// or, if ancestors are set, also at a '/', so the contents of matched directories match too
+    Matcher compile(const QStringList& patterns, bool ancestors);
+
+    /// The regular expression body for the glob pattern
+    static QString fromGlob(const QString& glob);
+
+    Rules mRules;
+    QStringList mErrors; ///< Filled by compile, so declared before the expressions
+    Matcher mInclude;
+    Matcher mExclude;
+};
+
+#endif // SCANFILTER_H
@@ -0,0 +1,25 @@
+#ifndef SCANOPTIONS_H
+#define SCANOPTIONS_H
+
+#include "imagehash.h"
+#include "scanfilter.h"
+#include "throttle.h"
+
+/// User-configurable parameters of the file collection
+struct ScanOptions
+{
+    bool images = false; ///< Calculate perceptual hashes to find visually similar images
+    ImageHash::Algorithm imageAlgorithm = ImageHash::ePHash;
+    int imageDistance = 8; ///< Maximum Hamming distance between hashes of similar images
+    bool directories = false; ///< Report identical directories as single entries
+    bool watch = false; ///< Keep the list up to date while files are changed on disk
+    bool archives = false; ///< Hash the members of zip and tar archives, see ArchiveReader
+    int workers = 0; ///< Scan the added directories in this number of processes, 0 means in this process
+    qint64 treeHashThreshold = 0; ///< Files of this size or larger are hashed by several threads, see TreeHash; 0 means never
+    int memoryBudget = 0; ///< MiB for the file records, larger scans are sorted on disk and only duplicates are listed; 0 means no limit
+    bool validateSessions = true; ///< Re-check modification times of the opened session files in background
+    ScanFilter::Rules filter; ///< Applied to the contents of the added directories
+    Throttle::Limits throttle; ///< Applied immediately, including the running scan
+};
+
+#endif // SCANOPTIONS_H
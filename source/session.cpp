@@ -0,0 +1,275 @@
+#include "session.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+
+const char* const Session::mcSuffix = "mdsession";
+
+namespace {
+
+// File layout, all the offsets are from the beginning of the file:
+//
+//   Header
+//   Record  records[recordCount]  -- one per file, 8-byte aligned
+//   Blob    hashes[hashCount]     -- unique hashes; records with the same hashIndex form a group
+//   Blob    roots[rootCount]
+//   char    strings[]             -- UTF-8 paths and hash bytes, referenced by Blob
+//
+// Integers are stored in the native byte order, so the file can be used in place after mapping;
+// the byte order mark rejects files written on a machine with another one.
+
+constexpr char cMagic[8] = { 'M', 'D', 'S', 'E', 'S', 'S', 'N', '\0' };
+constexpr quint32 cVersion = 1;
+constexpr quint32 cByteOrderMark = 0x01020304;
+constexpr qint64 cNoTime = std::numeric_limits<qint64>::min();
+
+struct Header
+{
+    char magic[8];
+    quint32 version;
+    quint32 byteOrderMark;
+    quint64 recordCount;
+    quint64 recordsOffset;
+    quint64 hashCount;
+    quint64 hashesOffset;
+    quint64 rootCount;
+    quint64 rootsOffset;
+    quint64 stringsOffset;
+    quint64 stringsSize;
+};
+
+struct Blob
+{
+    quint64 offset; ///< Relative to Header::stringsOffset
+    quint64 size;
+};
+
+struct Record
+{
+    enum Flags : quint32 { eDir = 1, eImage = 2, eMember = 4 };
+
+    Blob path;
+    qint64 size;
+    qint64 lastModified; ///< Milliseconds since epoch or cNoTime
+    quint64 imageHash;
+    quint32 hashIndex;
+    quint32 flags;
+    qint64 collapsedInto; ///< The index of the directory record this file is collapsed into, or -1
+};
+
+static_assert(sizeof(Header) % 8 == 0 && sizeof(Blob) % 8 == 0 && sizeof(Record) % 8 == 0,
+              "session structures should keep 8-byte alignment");
+
+/// Accumulates the string table
+class Strings
+{
+public:
+    Blob add(const QByteArray& bytes)
+    {
+        Blob blob { static_cast<quint64>(mData.size()), static_cast<quint64>(bytes.size()) };
+        mData.append(bytes);
+        return blob;
+    }
+
+    const QByteArray& data() const { return mData; }
+
+private:
+    QByteArray mData;
+};
+
+template <typename T>
+QByteArray bytes(const T* data, size_t count)
+{
+    return QByteArray(reinterpret_cast<const char*>(data), static_cast<int>(sizeof(T) * count));
+}
+
+} // namespace
+
+bool Session::save(const QString& fileName)
+{
+    Strings strings;
+    std::vector<Record> records;
+    std::vector<Blob> hashes;
+    std::vector<Blob> rootBlobs;
+    QHash<QByteArray, quint32> hashIndex;
+
+    auto record = [&](const FileItem& item, qint64 collapsedInto) {
+        auto ihash = hashIndex.find(item.hash);
+        if (ihash == hashIndex.end())
+        {
+            ihash = hashIndex.insert(item.hash, static_cast<quint32>(hashes.size()));
+            hashes.push_back(strings.add(item.hash));
+        }
+
+        Record r;
+        r.path = strings.add(item.fileInfo.absoluteFilePath().toUtf8());
+        r.size = item.size;
+        r.lastModified = item.lastModified.isValid() ? item.lastModified.toMSecsSinceEpoch() : cNoTime;
+        r.imageHash = item.imageHash;
+        r.hashIndex = *ihash;
+        r.flags = (item.isDir ? Record::eDir : 0) | (item.isImage ? Record::eImage : 0) | (item.isMember ? Record::eMember : 0);
+        r.collapsedInto = collapsedInto;
+        records.push_back(r);
+    };
+
+    for (const auto& item: items)
+    {
+        const auto dir = static_cast<qint64>(records.size());
+        record(item, -1);
+
+        if (item.isDir)
+            for (const auto& file: collapsed.value(item.fileInfo.absoluteFilePath()))
+                record(file, dir);
+    }
+
+    for (const auto& root: roots)
+        rootBlobs.push_back(strings.add(root.toUtf8()));
+
+    Header header;
+    std::copy(std::begin(cMagic), std::end(cMagic), header.magic);
+    header.version = cVersion;
+    header.byteOrderMark = cByteOrderMark;
+    header.recordCount = records.size();
+    header.recordsOffset = sizeof(Header);
+    header.hashCount = hashes.size();
+    header.hashesOffset = header.recordsOffset + sizeof(Record) * records.size();
+    header.rootCount = rootBlobs.size();
+    header.rootsOffset = header.hashesOffset + sizeof(Blob) * hashes.size();
+    header.stringsOffset = header.rootsOffset + sizeof(Blob) * rootBlobs.size();
+    header.stringsSize = static_cast<quint64>(strings.data().size());
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        mErrorString = file.errorString();
+        return false;
+    }
+
+    file.write(bytes(&header, 1));
+    file.write(bytes(records.data(), records.size()));
+    file.write(bytes(hashes.data(), hashes.size()));
+    file.write(bytes(rootBlobs.data(), rootBlobs.size()));
+    file.write(strings.data());
+
+    if (!file.commit())
+    {
+        mErrorString = file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+bool Session::load(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        mErrorString = file.errorString();
+        return false;
+    }
+
+    const auto fileSize = static_cast<quint64>(file.size());
+    const uchar* data = fileSize >= sizeof(Header) ? file.map(0, file.size()) : nullptr;
+    if (!data)
+    {
+        mErrorString = QObject::tr("'%1' is not a session file").arg(fileName);
+        return false;
+    }
+
+    const auto& header = *reinterpret_cast<const Header*>(data);
+
+    if (!std::equal(std::begin(cMagic), std::end(cMagic), header.magic))
+    {
+        mErrorString = QObject::tr("'%1' is not a session file").arg(fileName);
+        return false;
+    }
+
+    if (header.byteOrderMark != cByteOrderMark || header.version != cVersion)
+    {
+        mErrorString = QObject::tr("'%1' was saved by an incompatible version").arg(fileName);
+        return false;
+    }
+
+    auto fits = [fileSize](quint64 offset, quint64 count, quint64 size) {
+        return offset <= fileSize && count <= (fileSize - offset) / size;
+    };
+
+    if (!fits(header.recordsOffset, header.recordCount, sizeof(Record)) ||
+        !fits(header.hashesOffset, header.hashCount, sizeof(Blob)) ||
+        !fits(header.rootsOffset, header.rootCount, sizeof(Blob)) ||
+        !fits(header.stringsOffset, header.stringsSize, 1))
+    {
+        mErrorString = QObject::tr("'%1' is corrupted").arg(fileName);
+        return false;
+    }
+
+    const auto records = reinterpret_cast<const Record*>(data + header.recordsOffset);
+    const auto hashBlobs = reinterpret_cast<const Blob*>(data + header.hashesOffset);
+    const auto rootBlobs = reinterpret_cast<const Blob*>(data + header.rootsOffset);
+    const auto stringData = reinterpret_cast<const char*>(data + header.stringsOffset);
+
+    bool valid = true;
+    auto string = [&](const Blob& blob) {
+        if (blob.offset > header.stringsSize || blob.size > header.stringsSize - blob.offset)
+        {
+            valid = false;
+            return QByteArray();
+        }
+        return QByteArray(stringData + blob.offset, static_cast<int>(blob.size));
+    };
+
+    // the group hashes are shared between items thanks to implicit sharing of QByteArray
+    QVector<QByteArray> hashes(static_cast<int>(header.hashCount));
+    for (int i = 0; i < hashes.size(); ++i)
+        hashes[i] = string(hashBlobs[i]);
+
+    items.clear();
+    collapsed.clear();
+    roots.clear();
+
+    for (quint64 i = 0; i < header.recordCount && valid; ++i)
+    {
+        const auto& r = records[i];
+        if (r.hashIndex >= header.hashCount || r.collapsedInto >= static_cast<qint64>(i))
+        {
+            valid = false;
+            break;
+        }
+
+        FileItem item{ QFileInfo(QString::fromUtf8(string(r.path))), hashes[static_cast<int>(r.hashIndex)] };
+        item.size = r.size;
+        if (r.lastModified != cNoTime)
+            item.lastModified = QDateTime::fromMSecsSinceEpoch(r.lastModified);
+        item.imageHash = r.imageHash;
+        item.isImage = r.flags & Record::eImage;
+        item.isDir = r.flags & Record::eDir;
+        item.isMember = r.flags & Record::eMember;
+
+        if (r.collapsedInto < 0)
+        {
+            items.append(item);
+        }
+        else
+        {
+            const auto dir = QString::fromUtf8(string(records[r.collapsedInto].path));
+            collapsed[dir].append(item);
+        }
+    }
+
+    for (quint64 i = 0; i < header.rootCount && valid; ++i)
+        roots.append(QString::fromUtf8(string(rootBlobs[i])));
+
+    if (!valid)
+    {
+        mErrorString = QObject::tr("'%1' is corrupted").arg(fileName);
+        return false;
+    }
+
+    return true;
+}
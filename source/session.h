@@ -0,0 +1,28 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "fileinfomodel.h"
+
+/// Scan results saved to disk
+/// The file is a versioned binary snapshot which is memory-mapped on load, so nothing is re-read or re-stat'ed
+class Session
+{
+public:
+    QList<FileItem> items;
+    CollapsedDirs collapsed;
+    QStringList roots; ///< Directories added as a whole
+
+    /// Returns false and sets errorString on failure
+    bool save(const QString& fileName);
+    bool load(const QString& fileName);
+
+    QString errorString() const { return mErrorString; }
+
+    /// Session file extension
+    static const char* const mcSuffix;
+
+private:
+    QString mErrorString;
+};
+
+#endif // SESSION_H
@@ -1,6 +1,43 @@
 #include "settingsdialog.h"
 #include "ui_settingsdialog.h"
 
+namespace {
+
+/// Patterns are edited as a single line separated by ';', '\;' is a ';' inside a pattern
+QStringList splitPatterns(const QString& text)
+{
+    QStringList patterns;
+    QString pattern;
+    auto append = [&] {
+        if (!pattern.trimmed().isEmpty())
+            patterns.append(pattern.trimmed());
+        pattern.clear();
+    };
+
+    for (int i = 0; i < text.size(); ++i)
+    {
+        if (text[i] == '\\' && i + 1 < text.size() && text[i + 1] == ';')
+            pattern += text[++i];
+        else if (text[i] == ';')
+            append();
+        else
+            pattern += text[i];
+    }
+    append();
+
+    return patterns;
+}
+
+QString joinPatterns(const QStringList& patterns)
+{
+    QStringList escaped;
+    for (auto pattern: patterns)
+        escaped.append(pattern.replace(';', "\\;"));
+    return escaped.join("; ");
+}
+
+} // namespace
+
 SettingsDialog::SettingsDialog(QWidget *parent) :
     QDialog(parent),
     ui(new Ui::SettingsDialog)
@@ -22,3 +59,58 @@ void SettingsDialog::setDiffCommand(const QString& diffCommand)
 {
     ui->diffCommand->setText(diffCommand);
 }
+
+ScanOptions SettingsDialog::options() const
+{
+    ScanOptions options;
+    options.images = ui->images->isChecked();
+    options.imageAlgorithm = static_cast<ImageHash::Algorithm>(ui->imageAlgorithm->currentIndex());
+    options.imageDistance = ui->imageDistance->value();
+    options.directories = ui->directories->isChecked();
+    options.watch = ui->watch->isChecked();
+    options.archives = ui->archives->isChecked();
+    options.workers = ui->workers->value();
+    options.memoryBudget = ui->memoryBudget->value();
+    options.treeHashThreshold = static_cast<qint64>(ui->treeHashThreshold->value()) * 1024 * 1024;
+    options.validateSessions = ui->validateSessions->isChecked();
+    options.filter.include = splitPatterns(ui->include->text());
+    options.filter.exclude = splitPatterns(ui->exclude->text());
+    options.filter.minSize = static_cast<qint64>(ui->minSize->value()) * 1024;
+    options.filter.maxSize = static_cast<qint64>(ui->maxSize->value()) * 1024 * 1024;
+    // the minimum date means 'any', see specialValueText
+    if (ui->modifiedAfter->date() != ui->modifiedAfter->minimumDate())
+        options.filter.modifiedAfter = QDateTime(ui->modifiedAfter->date(), QTime(0, 0));
+    if (ui->modifiedBefore->date() != ui->modifiedBefore->minimumDate())
+        options.filter.modifiedBefore = QDateTime(ui->modifiedBefore->date(), QTime(23, 59, 59, 999));
+    options.filter.sameFilesystem = ui->sameFilesystem->isChecked();
+    options.throttle.megabytesPerSecond = ui->megabytesPerSecond->value();
+    options.throttle.operationsPerSecond = ui->operationsPerSecond->value();
+    options.throttle.priority = static_cast<Throttle::Priority>(ui->priority->currentIndex());
+    options.throttle.adaptive = ui->adaptive->isChecked();
+    return options;
+}
+
+void SettingsDialog::setOptions(const ScanOptions& options)
+{
+    ui->images->setChecked(options.images);
+    ui->imageAlgorithm->setCurrentIndex(options.imageAlgorithm);
+    ui->imageDistance->setValue(options.imageDistance);
+    ui->directories->setChecked(options.directories);
+    ui->watch->setChecked(options.watch);
+    ui->archives->setChecked(options.archives);
+    ui->workers->setValue(options.workers);
+    ui->memoryBudget->setValue(options.memoryBudget);
+    ui->treeHashThreshold->setValue(static_cast<int>(options.treeHashThreshold / (1024 * 1024)));
+    ui->validateSessions->setChecked(options.validateSessions);
+    ui->include->setText(joinPatterns(options.filter.include));
+    ui->exclude->setText(joinPatterns(options.filter.exclude));
+    ui->minSize->setValue(static_cast<int>(options.filter.minSize / 1024));
+    ui->maxSize->setValue(static_cast<int>(options.filter.maxSize / (1024 * 1024)));
+    ui->modifiedAfter->setDate(options.filter.modifiedAfter.isValid() ? options.filter.modifiedAfter.date() : ui->modifiedAfter->minimumDate());
+    ui->modifiedBefore->setDate(options.filter.modifiedBefore.isValid() ? options.filter.modifiedBefore.date() : ui->modifiedBefore->minimumDate());
+    ui->sameFilesystem->setChecked(options.filter.sameFilesystem);
+    ui->megabytesPerSecond->setValue(options.throttle.megabytesPerSecond);
+    ui->operationsPerSecond->setValue(options.throttle.operationsPerSecond);
+    ui->priority->setCurrentIndex(options.throttle.priority);
+    ui->adaptive->setChecked(options.throttle.adaptive);
+}
@@ -3,6 +3,8 @@
 
 #include <QDialog>
 
+#include "scanoptions.h"
+
 namespace Ui {
 class SettingsDialog;
 }
@@ -18,6 +20,9 @@ public:
     QString diffCommand() const;
     void setDiffCommand(const QString& diffCommand);
 
+    ScanOptions options() const;
+    void setOptions(const ScanOptions& options);
+
 private:
     Ui::SettingsDialog *ui;
 };
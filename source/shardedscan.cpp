@@ -0,0 +1,468 @@
+#include "shardedscan.h"
+
+#include <algorithm>
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QEventLoop>
+#include <QHash>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QProcess>
+#include <QRandomGenerator>
+#include <QThread>
+#include <QTimer>
+#include <QUrl>
+#include <QtConcurrent>
+#include <QtEndian>
+
+#include "progress.h"
+#include "scanfilter.h"
+#include "throttle.h"
+
+const char* const ShardedScan::mcWorkerArgument = "--worker";
+
+namespace {
+
+/// Frame: quint32 payload size (little endian), quint8 message type, payload
+enum Message : quint8
+{
+    eHello,   ///< worker --> coordinator: the shard number
+    eRequest, ///< coordinator --> worker: roots, filter, throttle limits, tree hash threshold and directories mode
+    eRecord,  ///< worker --> coordinator: size, modification time, hash and path of a file
+    eListing, ///< worker --> coordinator: path, files, subdirectories, excluded entries and readability of a directory
+    eWarning, ///< worker --> coordinator: a localized message
+    eAlive,   ///< worker --> coordinator: the collection advanced, e.g. while listing, but no files were hashed
+    eDone     ///< worker --> coordinator: all the records were sent
+};
+
+constexpr int cHeaderSize = 5;
+constexpr int cTimeout = 30000; ///< ms, the worker gives up if the coordinator does not respond
+constexpr qint64 cMaxPending = 4 * 1024 * 1024; ///< Bytes written by the worker before it waits for the coordinator
+constexpr int cSendInterval = 50; ///< ms, the worker sends the hashed files in batches at most this old
+constexpr int cInactivityTimeout = 5 * 60 * 1000; ///< ms without messages after which the coordinator gives up on a worker
+constexpr int cCancelInterval = 100; ///< ms, how often the coordinator checks the cancel flag
+
+void send(QLocalSocket* socket, Message type, const QByteArray& payload)
+{
+    char header[cHeaderSize];
+    qToLittleEndian<quint32>(static_cast<quint32>(payload.size()), header);
+    header[4] = static_cast<char>(type);
+    socket->write(header, cHeaderSize);
+    socket->write(payload);
+}
+
+/// Take a complete frame from the socket; false if it is not received completely yet
+bool take(QLocalSocket* socket, Message* type, QByteArray* payload)
+{
+    if (socket->bytesAvailable() < cHeaderSize)
+        return false;
+
+    const auto header = socket->peek(cHeaderSize);
+    const auto size = qFromLittleEndian<quint32>(header.constData());
+    if (socket->bytesAvailable() < cHeaderSize + static_cast<qint64>(size))
+        return false;
+
+    socket->read(cHeaderSize);
+    *type = static_cast<Message>(header[4]);
+    *payload = socket->read(size);
+    return true;
+}
+
+QDataStream& operator <<(QDataStream& out, const ScanFilter::Rules& rules)
+{
+    return out << rules.include << rules.exclude << rules.minSize << rules.maxSize
+               << rules.modifiedAfter << rules.modifiedBefore << rules.sameFilesystem;
+}
+
+QDataStream& operator >>(QDataStream& in, ScanFilter::Rules& rules)
+{
+    return in >> rules.include >> rules.exclude >> rules.minSize >> rules.maxSize
+              >> rules.modifiedAfter >> rules.modifiedBefore >> rules.sameFilesystem;
+}
+
+QDataStream& operator <<(QDataStream& out, const Throttle::Limits& limits)
+{
+    return out << limits.megabytesPerSecond << qint32(limits.operationsPerSecond)
+               << qint32(limits.priority) << limits.adaptive;
+}
+
+QDataStream& operator >>(QDataStream& in, Throttle::Limits& limits)
+{
+    qint32 operations = 0, priority = 0;
+    in >> limits.megabytesPerSecond >> operations >> priority >> limits.adaptive;
+    limits.operationsPerSecond = operations;
+    limits.priority = static_cast<Throttle::Priority>(priority);
+    return in;
+}
+
+/// Serialize the arguments into a message payload
+template <typename... Args>
+QByteArray pack(const Args&... args)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+    (void)std::initializer_list<int>{ (out << args, 0)... };
+    return payload;
+}
+
+} // namespace
+
+void ShardedScan::run(const QStringList& roots)
+{
+    const auto groups = split(roots);
+
+    QLocalServer server;
+    const auto name = QString("multidiff-%1-%2").arg(QCoreApplication::applicationPid()).arg(QRandomGenerator::global()->generate());
+    if (!server.listen(name))
+    {
+        mWarnings.append(QObject::tr("Unable to start worker processes: %1").arg(server.errorString()));
+        mFailed = roots;
+        return;
+    }
+
+    QEventLoop loop;
+    int running = groups.size();
+    QVector<QTimer*> timers;
+    auto finish = [&](int shard, bool ok) {
+        auto& s = mShards[shard];
+        if (s.finished)
+            return;
+
+        s.finished = true;
+        timers[shard]->stop();
+        if (!ok)
+        {
+            const auto warning = s.timedOut
+                    ? QObject::tr("The worker process for '%1' stopped responding, scanning in this process")
+                    : QObject::tr("The worker process for '%1' stopped unexpectedly, scanning in this process");
+            mWarnings.append(warning.arg(s.roots.join("', '")));
+            mFailed.append(s.roots);
+        }
+
+        if (--running == 0)
+            loop.quit();
+    };
+
+    // the connections refer to the locals, so they are broken before the locals are destroyed
+    QObject context;
+
+    mShards.resize(groups.size());
+    QVector<QProcess*> processes;
+    for (int i = 0; i < groups.size(); ++i)
+    {
+        mShards[i].roots = groups[i];
+
+        auto process = new QProcess(&server);
+        process->setProcessChannelMode(QProcess::ForwardedChannels);
+
+        // the worker has its own timeouts, but it may block where it cannot check them, e.g. in stat()
+        // on a dead network mount; the timer is restarted by every message
+        auto timer = new QTimer(&server);
+        timer->setSingleShot(true);
+        timer->setInterval(cInactivityTimeout);
+        QObject::connect(timer, &QTimer::timeout, &context, [&, i, process] {
+            mShards[i].timedOut = true;
+            process->kill();
+            finish(i, false);
+        });
+        timers.append(timer);
+        timer->start();
+        QObject::connect(process, &QProcess::errorOccurred, &context, [&, i](QProcess::ProcessError error) {
+            if (error == QProcess::FailedToStart)
+                finish(i, false);
+        });
+        QObject::connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), &context, [&, i] {
+            if (!mShards[i].socket) // crashed before connecting, otherwise the socket tells
+                finish(i, false);
+        });
+
+        process->start(QCoreApplication::applicationFilePath(), { mcWorkerArgument, server.fullServerName(), QString::number(i) });
+        processes.append(process);
+    }
+
+    if (mCancelled)
+    {
+        auto cancel = new QTimer(&server);
+        QObject::connect(cancel, &QTimer::timeout, &context, [&] {
+            if (!mCancelled->load())
+                return;
+            for (int i = 0; i < processes.size(); ++i)
+            {
+                processes[i]->kill();
+                finish(i, false);
+            }
+        });
+        cancel->start(cCancelInterval);
+    }
+
+    QObject::connect(&server, &QLocalServer::newConnection, &context, [&] {
+        while (auto socket = server.nextPendingConnection())
+        {
+            socket->setProperty("shard", -1); // unknown until the hello message
+            QObject::connect(socket, &QLocalSocket::readyRead, &context, [&, socket] {
+                receive(socket);
+                const int shard = socket->property("shard").toInt();
+                if (shard < 0 || mShards[shard].finished)
+                    return;
+
+                if (mShards[shard].done)
+                    finish(shard, true);
+                else
+                    timers[shard]->start();
+            });
+            QObject::connect(socket, &QLocalSocket::disconnected, &context, [&, socket] {
+                receive(socket); // the last records may still be buffered
+                const int shard = socket->property("shard").toInt();
+                if (shard >= 0)
+                    finish(shard, mShards[shard].done);
+            });
+        }
+    });
+
+    if (running > 0)
+        loop.exec();
+
+    for (auto process: processes)
+    {
+        if (!process->waitForFinished(1000))
+        {
+            process->kill();
+            process->waitForFinished();
+        }
+    }
+
+    // the failed shards are rescanned in process, so their partial results would be duplicated
+    for (const auto& shard: qAsConst(mShards))
+    {
+        if (!shard.done)
+            continue;
+
+        mItems.append(shard.items);
+        mWarnings.append(shard.warnings);
+        for (auto listing = shard.listings.cbegin(); listing != shard.listings.cend(); ++listing)
+            mListings.insert(listing.key(), listing.value());
+    }
+
+    // keep the order of roots
+    std::stable_sort(mItems.begin(), mItems.end(), [&roots](const FileItem& lhs, const FileItem& rhs) {
+        auto rootIndex = [&roots](const FileItem& item) {
+            const auto path = item.fileInfo.absoluteFilePath();
+            for (int i = 0; i < roots.size(); ++i)
+                if (path.startsWith(roots[i].endsWith('/') ? roots[i] : roots[i] + '/'))
+                    return i;
+            return roots.size();
+        };
+        return rootIndex(lhs) < rootIndex(rhs);
+    });
+}
+
+void ShardedScan::receive(QLocalSocket* socket)
+{
+    Message type;
+    QByteArray payload;
+    while (take(socket, &type, &payload))
+    {
+        QDataStream in(payload);
+        in.setVersion(QDataStream::Qt_5_6);
+
+        if (type == eHello)
+        {
+            qint32 shard = -1;
+            in >> shard;
+            if (shard < 0 || shard >= mShards.size() || mShards[shard].socket)
+            {
+                socket->abort();
+                return;
+            }
+
+            mShards[shard].socket = socket;
+            socket->setProperty("shard", shard);
+            send(socket, eRequest, pack(mShards[shard].roots, mOptions.filter, mOptions.throttle, mOptions.treeHashThreshold,
+                                        mOptions.directories));
+            continue;
+        }
+
+        // the late messages of a worker given up on are dropped, its roots are scanned in process
+        const int shard = socket->property("shard").toInt();
+        if (shard < 0 || mShards[shard].finished)
+            continue;
+
+        if (type == eRecord)
+        {
+            qint64 size = 0, lastModified = 0;
+            QByteArray hash, path;
+            in >> size >> lastModified >> hash >> path;
+
+            FileItem item{ QFileInfo(QString::fromUtf8(path)), hash };
+            item.size = size;
+            item.lastModified = QDateTime::fromMSecsSinceEpoch(lastModified);
+            mShards[shard].items.append(item);
+            Progress::add(1, size);
+        }
+        else if (type == eListing)
+        {
+            QString dir;
+            FileInfoModel::Collector::Listing listing;
+            in >> dir >> listing.files >> listing.dirs >> listing.excluded >> listing.readable;
+            mShards[shard].listings.insert(dir, listing);
+        }
+        else if (type == eWarning)
+        {
+            QString warning;
+            in >> warning;
+            mShards[shard].warnings.append(warning);
+        }
+        else if (type == eDone)
+        {
+            mShards[shard].done = true;
+        }
+    }
+}
+
+QVector<QStringList> ShardedScan::split(const QStringList& roots) const
+{
+    // roots on the same disk go to the same worker, so the disk is not read concurrently by several processes
+    QHash<quint64, QStringList> byDevice;
+    QVector<QStringList> groups;
+    for (const auto& root: roots)
+    {
+        quint64 device = 0;
+        if (ScanFilter::device(root, &device))
+            byDevice[device].append(root);
+        else
+            groups.append({ root });
+    }
+    for (const auto& group: qAsConst(byDevice))
+        groups.append(group);
+
+    std::sort(groups.begin(), groups.end(), [](const QStringList& lhs, const QStringList& rhs) {
+        return lhs.size() > rhs.size();
+    });
+
+    // the largest groups first, each to the least loaded shard
+    QVector<QStringList> shards(std::min(std::max(mOptions.workers, 1), groups.size()));
+    for (const auto& group: groups)
+    {
+        auto shard = std::min_element(shards.begin(), shards.end(), [](const QStringList& lhs, const QStringList& rhs) {
+            return lhs.size() < rhs.size();
+        });
+        shard->append(group);
+    }
+
+    return shards;
+}
+
+int ShardedScan::worker(const QString& serverName, int shard)
+{
+    QLocalSocket socket;
+    socket.connectToServer(serverName);
+    if (!socket.waitForConnected(cTimeout))
+        return 1;
+
+    send(&socket, eHello, pack(qint32(shard)));
+
+    Message type;
+    QByteArray payload;
+    while (!take(&socket, &type, &payload))
+        if (!socket.waitForReadyRead(cTimeout))
+            return 1;
+
+    if (type != eRequest)
+        return 1;
+
+    QStringList roots;
+    ScanOptions options;
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_5_6);
+    in >> roots >> options.filter >> options.throttle >> options.treeHashThreshold >> options.directories;
+    Throttle::setLimits(options.throttle);
+
+    // directories, archives and images are processed by the coordinator on the merged list;
+    // the directory hashes need the listings
+    const bool listings = options.directories;
+    options.directories = options.archives = options.images = false;
+    options.workers = 0;
+
+    // the coordinator has reported the invalid patterns already
+    const auto filterErrors = ScanFilter(options.filter).errors();
+
+    // each file is reported as soon as it is hashed: the collection runs in another thread and
+    // this one sends the records queued by the hashing threads, the socket is used by one thread only
+    for (const auto& root: roots)
+    {
+        FileInfoModel::Collector collector(nullptr, options);
+        collector.setRecordListings(listings);
+
+        QMutex mutex;
+        QList<FileItem> queue; // guarded by mutex
+        collector.setHashedCallback([&mutex, &queue](const FileItem& item) {
+            QMutexLocker lock(&mutex);
+            queue.append(item);
+        });
+
+        auto sendQueued = [&] {
+            QList<FileItem> items;
+            {
+                QMutexLocker lock(&mutex);
+                items.swap(queue);
+            }
+
+            for (const auto& item: qAsConst(items))
+            {
+                send(&socket, eRecord, pack(item.size, item.lastModified.toMSecsSinceEpoch(), item.hash,
+                                            item.fileInfo.absoluteFilePath().toUtf8()));
+
+                // do not keep the whole list in the socket buffer if the coordinator is busy
+                if (socket.bytesToWrite() > cMaxPending && !socket.waitForBytesWritten(cTimeout))
+                    return false;
+            }
+            socket.flush();
+            return true;
+        };
+
+        auto collection = QtConcurrent::run([&collector, &root] { collector.collect({ QUrl::fromLocalFile(root) }); });
+        bool sent = true;
+        Progress::Snapshot last;
+        while (sent && !collection.isFinished())
+        {
+            QThread::msleep(cSendInterval);
+            sent = sendQueued();
+
+            // a long listing sends no records, but the coordinator should not give up on it
+            const auto progress = Progress::snapshot();
+            if (progress.stage != last.stage || progress.files != last.files)
+                send(&socket, eAlive, {});
+            last = progress;
+        }
+
+        // the collection refers to the locals
+        collection.waitForFinished();
+        if (!sent || !sendQueued())
+            return 1;
+
+        const auto& dirs = collector.listings();
+        for (auto listing = dirs.cbegin(); listing != dirs.cend(); ++listing)
+        {
+            const auto& entries = listing.value();
+            send(&socket, eListing, pack(listing.key(), entries.files, entries.dirs, entries.excluded, entries.readable));
+            if (socket.bytesToWrite() > cMaxPending && !socket.waitForBytesWritten(cTimeout))
+                return 1;
+        }
+
+        for (const auto& warning: collector.warnings())
+            if (!filterErrors.contains(warning))
+                send(&socket, eWarning, pack(warning));
+    }
+
+    send(&socket, eDone, {});
+    while (socket.bytesToWrite() > 0)
+        if (!socket.waitForBytesWritten(cTimeout))
+            return 1;
+
+    socket.disconnectFromServer();
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef SHARDEDSCAN_H
+#define SHARDEDSCAN_H
+
+#include <atomic>
+
+#include <QHash>
+#include <QList>
+#include <QStringList>
+
+#include "fileinfomodel.h"
+
+class QLocalSocket;
+
+/// Scans directories in worker processes of the same executable, so a crash or a file
+/// descriptor limit of one worker does not affect the others
+/// The roots are split by device, so each disk is read by one process only; workers stream
+/// the file records back through a local socket, the coordinator merges them
+class ShardedScan
+{
+public:
+    explicit ShardedScan(const ScanOptions& options) : mOptions(options) {}
+
+    /// Run the workers and wait for them; events are processed meanwhile
+    void run(const QStringList& roots);
+
+    /// The workers are killed when the flag is set, their roots are reported as failed
+    void setCancelFlag(const std::atomic<bool>* cancelled) { mCancelled = cancelled; }
+
+    const QList<FileItem>& items() const { return mItems; }
+    const QStringList& warnings() const { return mWarnings; }
+
+    /// The directory listings of the scanned roots, sent in the directories mode only
+    const QHash<QString, FileInfoModel::Collector::Listing>& listings() const { return mListings; }
+
+    /// The roots of the workers which could not finish, they should be scanned in process
+    const QStringList& failed() const { return mFailed; }
+
+    /// The worker process entry point: connect to the coordinator, scan the requested roots,
+    /// report the results and exit; returns the process exit code
+    static int worker(const QString& serverName, int shard);
+
+    /// The command line is '<executable> --worker <server name> <shard number>'
+    static const char* const mcWorkerArgument;
+
+private:
+    /// Group the roots by device, then distribute the groups between mOptions.workers shards
+    QVector<QStringList> split(const QStringList& roots) const;
+
+    /// Parse the complete messages received from the worker
+    void receive(QLocalSocket* socket);
+
+    struct Shard
+    {
+        QStringList roots;
+        QList<FileItem> items; ///< Received records, dropped if the worker fails
+        QStringList warnings; ///< Received warnings, dropped if the worker fails
+        QHash<QString, FileInfoModel::Collector::Listing> listings; ///< Received listings, dropped if the worker fails
+        QLocalSocket* socket = nullptr;
+        bool done = false; ///< All the records were received
+        bool finished = false; ///< Successfully or not
+        bool timedOut = false; ///< Killed after no messages for a long time
+    };
+
+    const ScanOptions mOptions;
+    const std::atomic<bool>* mCancelled = nullptr; ///< See setCancelFlag
+    QVector<Shard> mShards;
+    QList<FileItem> mItems;
+    QStringList mWarnings;
+    QHash<QString, FileInfoModel::Collector::Listing> mListings;
+    QStringList mFailed;
+};
+
+#endif // SHARDEDSCAN_H
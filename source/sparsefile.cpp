@@ -0,0 +1,130 @@
+#include "sparsefile.h"
+
+#include <algorithm>
+
+#include <QCryptographicHash>
+#include <QFile>
+
+#include "profiler.h"
+#include "throttle.h"
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr int cZerosSize = 256 * 1024;
+
+} // namespace
+
+bool SparseFile::dataRegions(int fd, qint64* size, QVector<Region>* regions)
+{
+#if defined(Q_OS_UNIX) && defined(SEEK_DATA)
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+
+    // all the blocks of a dense file are allocated, there is nothing to skip
+    if (static_cast<qint64>(st.st_blocks) * 512 >= static_cast<qint64>(st.st_size))
+        return false;
+
+    // the regions are looked up by moving the file offset, the caller's reads continue from the original one
+    const off_t origin = lseek(fd, 0, SEEK_CUR);
+    if (origin < 0)
+        return false;
+
+    auto fail = [&] {
+        lseek(fd, origin, SEEK_SET);
+        regions->clear();
+        return false;
+    };
+
+    *size = st.st_size;
+    for (off_t position = 0; position < st.st_size;)
+    {
+        const off_t begin = lseek(fd, position, SEEK_DATA);
+        if (begin < 0)
+        {
+            if (errno == ENXIO) // a hole up to the end
+                break;
+            return fail();
+        }
+
+        const off_t end = lseek(fd, begin, SEEK_HOLE);
+        if (end < 0)
+            return fail();
+
+        regions->append({ begin, std::min<qint64>(end, st.st_size) });
+        position = end;
+    }
+
+    if (lseek(fd, origin, SEEK_SET) != origin)
+        return fail();
+    return true;
+#else
+    Q_UNUSED(fd);
+    Q_UNUSED(size);
+    Q_UNUSED(regions);
+    return false;
+#endif
+}
+
+bool SparseFile::hashRange(QFile* file, qint64 begin, qint64 end, const QVector<Region>& regions,
+                           QByteArray* buffer, QCryptographicHash* hash, quint64 device)
+{
+    // the first region which is not entirely before the range
+    auto region = std::upper_bound(regions.cbegin(), regions.cend(), begin, [](qint64 position, const Region& r) {
+        return position < r.end;
+    });
+
+    qint64 position = begin;
+    for (; region != regions.cend() && region->begin < end; ++region)
+    {
+        const auto dataBegin = std::max(region->begin, begin);
+        const auto dataEnd = std::min(region->end, end);
+
+        hashZeros(dataBegin - position, hash);
+        if (!file->seek(dataBegin) || !hashRange(file, dataEnd, buffer, hash, device))
+            return false;
+        position = dataEnd;
+    }
+    hashZeros(end - position, hash);
+    return true;
+}
+
+bool SparseFile::hashRange(QFile* file, qint64 end, QByteArray* buffer, QCryptographicHash* hash, quint64 device)
+{
+    for (qint64 position = file->pos(); end < 0 || position < end;)
+    {
+        const qint64 chunk = end < 0 ? buffer->size() : std::min<qint64>(buffer->size(), end - position);
+        qint64 length = 0;
+        {
+            Throttle::Read throttle(device, chunk);
+            Profiler::Scope scope(Profiler::eRead);
+            length = file->read(buffer->data(), chunk);
+        }
+
+        if (length < 0)
+            return false;
+
+        if (length == 0) // truncated meanwhile
+            break;
+
+        position += length;
+        Profiler::Scope scope(Profiler::eHash);
+        hash->addData(buffer->constData(), static_cast<int>(length));
+    }
+    return true;
+}
+
+void SparseFile::hashZeros(qint64 size, QCryptographicHash* hash)
+{
+    static const QByteArray zeros(cZerosSize, '\0');
+
+    Profiler::Scope scope(Profiler::eHash);
+    for (; size > 0; size -= zeros.size())
+        hash->addData(zeros.constData(), static_cast<int>(std::min<qint64>(size, zeros.size())));
+}
@@ -0,0 +1,41 @@
+#ifndef SPARSEFILE_H
+#define SPARSEFILE_H
+
+#include <QByteArray>
+#include <QVector>
+
+class QCryptographicHash;
+class QFile;
+
+/// Hashing of file ranges which skips the holes of sparse files: only the data regions reported by
+/// SEEK_DATA/SEEK_HOLE are read, the holes are fed to the hash as zeros, so the hash equals a dense read
+class SparseFile
+{
+public:
+    /// A data region: [begin, end)
+    struct Region
+    {
+        qint64 begin;
+        qint64 end;
+    };
+
+    /// List the data regions of the open file, everything else is holes reading as zeros
+    /// Returns false for dense files and where holes are not reported, the file should be read as a whole then;
+    /// the file offset is restored and regions is left empty in this case
+    static bool dataRegions(int fd, qint64* size, QVector<Region>* regions);
+
+    /// Hash [begin, end) of the file, reading only the given data regions
+    /// The reads are limited by Throttle within the budget of the given device (st_dev)
+    /// Returns false on a read error
+    static bool hashRange(QFile* file, qint64 begin, qint64 end, const QVector<Region>& regions,
+                          QByteArray* buffer, QCryptographicHash* hash, quint64 device);
+
+    /// Hash the file from the current position up to end, or up to the end of file if end is negative
+    /// Returns false on a read error
+    static bool hashRange(QFile* file, qint64 end, QByteArray* buffer, QCryptographicHash* hash, quint64 device);
+
+    /// Hash a hole as the zeros a dense read would return
+    static void hashZeros(qint64 size, QCryptographicHash* hash);
+};
+
+#endif // SPARSEFILE_H
@@ -1,6 +1,5 @@
 #include "statusmessage.h"
 
-#include <QCoreApplication>
 #include <QStatusBar>
 #include <QString>
 
@@ -8,13 +7,12 @@ QStatusBar* StatusMessage::mBar = nullptr;
 
 void StatusMessage::show(const QString& text, int timeout)
 {
-    Q_ASSERT(mBar); if (!mBar) return;
+    if (!mBar) return;
     mBar->showMessage(text, timeout);
-    QCoreApplication::processEvents();
 }
 
 void StatusMessage::clear()
 {
-    Q_ASSERT(mBar); if (!mBar) return;
+    if (!mBar) return;
     mBar->clearMessage();
 }
@@ -5,20 +5,20 @@ class QStatusBar;
 class QString;
 
 /// Shows simple text in the status bar
+/// The message is painted by the event loop, so it is called from the GUI thread only;
+/// the progress of a running collection is reported through Progress instead
 class StatusMessage
 {
 public:
-    /// Call this function first
+    /// Call this function first; without the status bar (e.g. in worker processes) messages are ignored
     static void setStatusBar(QStatusBar* statusBar) { mBar = statusBar; }
 
     /// \brief Displays the given text for the specified number of milli-seconds (timeout).
     /// If timeout is 0, the message remains displayed until clear() is called or until show()
     /// is called again to change the message.
-    /// WARNING: Please set the status bar first.
     static void show(const QString& text, int timeout = mcShort);
 
     /// Removes any message being shown.
-    /// WARNING: Please set the status bar first.
     static void clear();
 
     static const int mcShort = 2000;
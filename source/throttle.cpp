@@ -0,0 +1,172 @@
+#include "throttle.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+std::atomic<bool> Throttle::mActive { false };
+std::atomic<int> Throttle::mGeneration { 0 };
+
+namespace {
+
+/// The budget and the latency statistics of one device
+struct Bucket
+{
+    qint64 last = 0;     ///< The time of the last refill
+    double bytes = 0;    ///< Available bytes, negative when the budget is overdrawn
+    double operations = 0;
+    double fast = 0;     ///< Short-term average read latency, ns
+    double slow = 0;     ///< Long-term average read latency, ns
+    double factor = 1;   ///< Scale of the limits chosen by the adaptive back-off
+};
+
+constexpr double cFastWeight = 0.2;
+constexpr double cSlowWeight = 0.01;
+constexpr double cCongested = 2.0; ///< The short-term latency is that many times higher than usual
+constexpr double cRelaxed = 1.25;
+constexpr double cMinFactor = 0.05;
+constexpr qint64 cSlice = 50 * 1000; ///< Waits are split to pick up the new limits, us
+
+QMutex gMutex; ///< Guards gLimits and gBuckets
+Throttle::Limits gLimits;
+QHash<quint64, Bucket> gBuckets;
+
+/// Take the amount from the budget replenished at the given rate (per second)
+/// Returns the time to wait until the budget is positive again, seconds
+double take(double* tokens, double rate, double amount, double elapsed)
+{
+    if (rate <= 0)
+        return 0;
+
+    // one second of burst, so the idle time is not accumulated
+    *tokens = std::min(*tokens + elapsed * rate, rate) - amount;
+    return *tokens < 0 ? -*tokens / rate : 0;
+}
+
+} // namespace
+
+qint64 Throttle::now()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Throttle::setLimits(const Throttle::Limits& limits)
+{
+    QMutexLocker lock(&gMutex);
+    gLimits = limits;
+    gBuckets.clear(); // forget the debts made with the old limits
+    mActive.store(limits.megabytesPerSecond > 0 || limits.operationsPerSecond > 0 || limits.adaptive);
+    ++mGeneration;
+}
+
+Throttle::Limits Throttle::limits()
+{
+    QMutexLocker lock(&gMutex);
+    return gLimits;
+}
+
+Throttle::Read::Read(quint64 device, qint64 bytes) :
+    mDevice(device)
+{
+    applyPriority();
+    if (!mActive.load(std::memory_order_relaxed))
+        return;
+
+    acquire(device, bytes);
+    mStart = now(); // the wait is not a part of the latency
+}
+
+Throttle::Read::~Read()
+{
+    if (mStart >= 0)
+        complete(mDevice, now() - mStart);
+}
+
+void Throttle::acquire(quint64 device, qint64 bytes)
+{
+    const int generation = mGeneration.load();
+    qint64 wait = 0;
+    {
+        QMutexLocker lock(&gMutex);
+        auto& bucket = gBuckets[device];
+        const qint64 time = now();
+        const double elapsed = bucket.last ? (time - bucket.last) / 1e9 : 0;
+        bucket.last = time;
+
+        const double factor = gLimits.adaptive ? bucket.factor : 1;
+        double seconds = std::max(take(&bucket.bytes, gLimits.megabytesPerSecond * 1024 * 1024 * factor, bytes, elapsed),
+                                  take(&bucket.operations, gLimits.operationsPerSecond * factor, 1, elapsed));
+
+        // without explicit limits the back-off leaves the disk idle for a part of the time
+        if (gLimits.adaptive && bucket.factor < 1)
+            seconds = std::max(seconds, bucket.fast / 1e9 * (1 / bucket.factor - 1));
+
+        wait = static_cast<qint64>(seconds * 1e6);
+    }
+
+    while (wait > 0 && mGeneration.load() == generation)
+    {
+        const qint64 slice = std::min(wait, cSlice);
+        QThread::usleep(static_cast<unsigned long>(slice));
+        wait -= slice;
+    }
+}
+
+void Throttle::complete(quint64 device, qint64 latency)
+{
+    QMutexLocker lock(&gMutex);
+    if (!gLimits.adaptive)
+        return;
+
+    // the disk is congested when the recent reads are much slower than the usual ones
+    auto& bucket = gBuckets[device];
+    if (bucket.slow == 0)
+    {
+        bucket.fast = bucket.slow = latency;
+        return;
+    }
+
+    bucket.fast += (latency - bucket.fast) * cFastWeight;
+    bucket.slow += (latency - bucket.slow) * cSlowWeight;
+
+    if (bucket.fast > bucket.slow * cCongested)
+        bucket.factor = std::max(bucket.factor * 0.8, cMinFactor);
+    else if (bucket.fast < bucket.slow * cRelaxed)
+        bucket.factor = std::min(bucket.factor * 1.1, 1.0);
+}
+
+void Throttle::applyPriority()
+{
+    // the priority belongs to the thread, so each one sets it after the limits are changed
+    thread_local int applied = 0;
+    const int generation = mGeneration.load();
+    if (applied == generation)
+        return;
+    applied = generation;
+
+#ifdef Q_OS_LINUX
+    // <linux/ioprio.h> is not available everywhere
+    enum { eWhoProcess = 1, eClassShift = 13, eClassNone = 0, eClassBestEffort = 2, eClassIdle = 3, eLowest = 7 };
+
+    int value = eClassNone << eClassShift; // follow the CPU nice value
+    switch (limits().priority)
+    {
+        case eBestEffort: value = eClassBestEffort << eClassShift | eLowest; break;
+        case eIdle:       value = eClassIdle << eClassShift; break;
+        case eNormal:     break;
+    }
+
+    // with zero pid IOPRIO_WHO_PROCESS means the calling thread
+    ::syscall(SYS_ioprio_set, eWhoProcess, 0, value);
+#endif
+}
@@ -0,0 +1,58 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <atomic>
+
+#include <QtGlobal>
+
+/// Limits the disk load of the scan so it does not starve other workloads:
+/// token buckets of bytes and operations per second for each device, I/O priority class
+/// of the reading threads and adaptive back-off when the read latency rises
+/// The limits may be changed at any time, running reads pick them up immediately
+class Throttle
+{
+public:
+    enum Priority
+    {
+        eNormal,     ///< Do not change the priority
+        eBestEffort, ///< The lowest level of the best-effort class
+        eIdle        ///< Read only when nobody else uses the disk
+    };
+
+    struct Limits
+    {
+        double megabytesPerSecond = 0; ///< Per device, 0 means unlimited
+        int operationsPerSecond = 0;   ///< Per device, 0 means unlimited
+        Priority priority = eNormal;
+        bool adaptive = false;         ///< Slow down when the read latency grows
+    };
+
+    static void setLimits(const Limits& limits);
+    static Limits limits();
+
+    /// Waits for the device budget before the read and measures its latency
+    class Read
+    {
+    public:
+        Read(quint64 device, qint64 bytes);
+        ~Read();
+
+        Read(const Read&) = delete;
+        Read& operator =(const Read&) = delete;
+
+    private:
+        const quint64 mDevice;
+        qint64 mStart = -1; ///< -1 if the latency is not measured
+    };
+
+private:
+    static void acquire(quint64 device, qint64 bytes);
+    static void complete(quint64 device, qint64 latency);
+    static void applyPriority();
+    static qint64 now();
+
+    static std::atomic<bool> mActive; ///< There are some limits, so Read is not a no-op
+    static std::atomic<int> mGeneration; ///< Incremented on each change of the limits
+};
+
+#endif // THROTTLE_H
@@ -0,0 +1,151 @@
+#include "treehash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QThreadPool>
+#include <QVector>
+#include <QtConcurrent>
+
+#include "profiler.h"
+#include "sparsefile.h"
+
+const char* const TreeHash::mcTag = "tree:";
+
+namespace {
+
+constexpr char cLeaf = 0;
+constexpr char cNode = 1;
+constexpr int cBufferSize = 256 * 1024; ///< Chunks are read by parts of this size
+
+/// Hash the given chunk; holes of a sparse file, where regions is set, are hashed as zeros without reading
+/// Returns false on a read error
+bool hashChunk(QFile* file, qint64 chunk, qint64 size, const QVector<SparseFile::Region>* regions,
+               QByteArray* buffer, quint64 device, QByteArray* hash)
+{
+    QCryptographicHash calculator(QCryptographicHash::Sha1);
+    calculator.addData(&cLeaf, 1);
+
+    const auto begin = chunk * TreeHash::mcChunkSize;
+    const auto end = std::min(begin + TreeHash::mcChunkSize, size);
+    if (regions)
+    {
+        if (!SparseFile::hashRange(file, begin, end, *regions, buffer, &calculator, device))
+            return false;
+    }
+    else if (!file->seek(begin) || !SparseFile::hashRange(file, end, buffer, &calculator, device))
+        return false;
+
+    *hash = calculator.result();
+    return true;
+}
+
+} // namespace
+
+bool TreeHash::calculate(const QString& path, qint64 size, quint64 device, int threads,
+                         const QVector<SparseFile::Region>* regions, QByteArray* hash)
+{
+    const auto chunks = std::max<qint64>((size + mcChunkSize - 1) / mcChunkSize, 1);
+    QVector<QByteArray> level(static_cast<int>(chunks));
+    QByteArray* leaves = level.data(); // nothing is detached from other threads
+
+    // each thread takes the next chunk; a file per thread, so the reads do not share the position
+    std::atomic<qint64> next(0);
+    std::atomic<bool> failed(false);
+    auto work = [&] {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        {
+            failed = true;
+            return;
+        }
+
+        QByteArray buffer(cBufferSize, Qt::Uninitialized);
+        for (qint64 chunk = next++; chunk < chunks && !failed; chunk = next++)
+            if (!hashChunk(&file, chunk, size, regions, &buffer, device, &leaves[chunk]))
+                failed = true;
+    };
+
+    // the calling thread works too, it would wait otherwise
+    QThreadPool pool;
+    const int helpers = static_cast<int>(std::min<qint64>(std::max(threads, 1), chunks)) - 1;
+    pool.setMaxThreadCount(std::max(helpers, 1));
+    for (int i = 0; i < helpers; ++i)
+        QtConcurrent::run(&pool, work);
+    work();
+    pool.waitForDone();
+
+    if (failed)
+        return false;
+
+    *hash = combine(std::move(level));
+    return true;
+}
+
+TreeHash::Calculator::Calculator() : mLeaf(QCryptographicHash::Sha1)
+{
+    mLeaf.addData(&cLeaf, 1);
+}
+
+void TreeHash::Calculator::addData(const char* data, qint64 size)
+{
+    while (size > 0)
+    {
+        if (mLeafSize == mcChunkSize)
+        {
+            mLeaves.append(mLeaf.result());
+            mLeaf.reset();
+            mLeaf.addData(&cLeaf, 1);
+            mLeafSize = 0;
+        }
+
+        const auto length = std::min(size, mcChunkSize - mLeafSize);
+        mLeaf.addData(data, static_cast<int>(length));
+        mLeafSize += length;
+        data += length;
+        size -= length;
+    }
+}
+
+QByteArray TreeHash::Calculator::result()
+{
+    // an empty file has a single empty chunk, as in calculate
+    if (mLeafSize > 0 || mLeaves.isEmpty())
+        mLeaves.append(mLeaf.result());
+    return combine(mLeaves);
+}
+
+QByteArray TreeHash::combine(QVector<QByteArray> level)
+{
+    Profiler::Scope scope(Profiler::eHash);
+    while (level.size() > 1)
+    {
+        QVector<QByteArray> parents;
+        parents.reserve((level.size() + 1) / 2);
+        for (int i = 0; i + 1 < level.size(); i += 2)
+        {
+            QCryptographicHash calculator(QCryptographicHash::Sha1);
+            calculator.addData(&cNode, 1);
+            calculator.addData(level[i]);
+            calculator.addData(level[i + 1]);
+            parents.append(calculator.result());
+        }
+        if (level.size() % 2)
+            parents.append(level.last());
+        level.swap(parents);
+    }
+
+    return mcTag + level.first();
+}
+
+QString TreeHash::toString(const QByteArray& hash)
+{
+    if (!isTreeHash(hash))
+        return hash.toBase64();
+
+    const auto tagSize = static_cast<int>(qstrlen(mcTag));
+    return mcTag + hash.mid(tagSize).toBase64();
+}
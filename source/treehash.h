@@ -0,0 +1,52 @@
+#ifndef TREEHASH_H
+#define TREEHASH_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QString>
+#include <QVector>
+
+#include "sparsefile.h"
+
+/// Hash of a large file calculated by several threads: a Merkle tree of SHA-1 digests of fixed-size chunks
+/// leaf = SHA-1(0x00, chunk), node = SHA-1(0x01, left, right), an odd node goes to the next level as is
+/// The digest is prefixed with mcTag, so it never equals a whole-file SHA-1 of the same contents
+class TreeHash
+{
+public:
+    /// Hash the file of the given size by the given number of threads; the result does not depend on the threads
+    /// The reads are limited by Throttle within the budget of the given device (st_dev)
+    /// Only the data regions of a sparse file are read where regions is set, the holes are hashed as zeros
+    /// Returns false on a read error
+    static bool calculate(const QString& path, qint64 size, quint64 device, int threads,
+                          const QVector<SparseFile::Region>* regions, QByteArray* hash);
+
+    /// Builds the same digest from data which can only be read sequentially, e.g. archive members
+    class Calculator
+    {
+    public:
+        Calculator();
+
+        void addData(const char* data, qint64 size);
+        QByteArray result();
+
+    private:
+        QCryptographicHash mLeaf;
+        qint64 mLeafSize = 0; ///< Bytes of the current chunk
+        QVector<QByteArray> mLeaves;
+    };
+
+    static bool isTreeHash(const QByteArray& hash) { return hash.startsWith(mcTag); }
+
+    /// Base64 of the hash; tree digests keep the tag, e.g. "tree:3q2+7w..."
+    static QString toString(const QByteArray& hash);
+
+    static const qint64 mcChunkSize = 4 * 1024 * 1024;
+    static const char* const mcTag;
+
+private:
+    /// The tagged root of the tree of the given leaves
+    static QByteArray combine(QVector<QByteArray> level);
+};
+
+#endif // TREEHASH_H
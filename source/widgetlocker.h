@@ -10,13 +10,11 @@ public:
     AppCursorLocker(Qt::CursorShape cursor = Qt::BusyCursor)
     {
         QApplication::setOverrideCursor(cursor);
-        QCoreApplication::processEvents();
     }
 
    ~AppCursorLocker()
     {
         QApplication::restoreOverrideCursor();
-        QCoreApplication::processEvents();
     }
 };
 
@@ -29,13 +27,11 @@ public:
         mEnabledBackup(mWidget->isEnabled())
     {
         mWidget->setEnabled(false);
-        QCoreApplication::processEvents();
     }
 
     ~WidgetLocker()
     {
         mWidget->setEnabled(mEnabledBackup);
-        QCoreApplication::processEvents();
     }
 
 private:
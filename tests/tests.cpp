@@ -0,0 +1,556 @@
+#include <algorithm>
+
+#include <QApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtEndian>
+#include <QtTest>
+
+#include <zlib.h>
+
+#ifdef Q_OS_UNIX
+#include <csignal>
+#include <unistd.h>
+#endif
+
+#include "archivereader.h"
+#include "externalsort.h"
+#include "fileinfomodel.h"
+#include "scanfilter.h"
+#include "session.h"
+#include "shardedscan.h"
+#include "sparsefile.h"
+#include "treegenerator.h"
+#include "treehash.h"
+
+namespace {
+
+/// Set for the worker processes which should be killed as soon as they start
+const char* const cKillWorkers = "MULTIDIFF_TESTS_KILL_WORKERS";
+
+/// Deterministic contents of the given size
+QByteArray contents(int size, quint32 seed)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = static_cast<char>(seed >> 16);
+    }
+    return data;
+}
+
+bool writeFile(const QString& path, const QByteArray& data)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+/// Relative path --> contents
+using Files = QMap<QString, QByteArray>;
+
+QByteArray hashOf(const QString& path, qint64 treeThreshold = 0)
+{
+    FileItem item;
+    QString warning;
+    return FileInfoModel::Collector::hashFile(path, &item, &warning, 0, treeThreshold) ? item.hash : QByteArray();
+}
+
+/// Raw deflate (windowBits -15) or gzip (windowBits 31)
+QByteArray deflateData(const QByteArray& data, int windowBits)
+{
+    z_stream stream = {};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return {};
+
+    QByteArray out(static_cast<int>(deflateBound(&stream, static_cast<uLong>(data.size()))), Qt::Uninitialized);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = static_cast<uInt>(out.size());
+    const bool ok = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+    out.resize(static_cast<int>(stream.total_out));
+    deflateEnd(&stream);
+    return ok ? out : QByteArray();
+}
+
+quint32 crc(const QByteArray& data)
+{
+    return static_cast<quint32>(crc32(0, reinterpret_cast<const Bytef*>(data.constData()), static_cast<uInt>(data.size())));
+}
+
+void put16(QByteArray* out, quint16 value)
+{
+    char bytes[2];
+    qToLittleEndian(value, bytes);
+    out->append(bytes, 2);
+}
+
+void put32(QByteArray* out, quint32 value)
+{
+    char bytes[4];
+    qToLittleEndian(value, bytes);
+    out->append(bytes, 4);
+}
+
+QByteArray tarArchive(const Files& files)
+{
+    QByteArray tar;
+    for (auto file = files.cbegin(); file != files.cend(); ++file)
+    {
+        QByteArray header(512, '\0');
+        const auto name = file.key().toUtf8();
+        memcpy(header.data(), name.constData(), static_cast<size_t>(name.size()));
+        memcpy(header.data() + 100, "0000644", 7);
+        memcpy(header.data() + 124, QByteArray::number(file.value().size(), 8).rightJustified(11, '0').constData(), 11);
+        memcpy(header.data() + 136, "14000000000", 11);
+        header[156] = '0';
+        memcpy(header.data() + 257, "ustar\0" "00", 8);
+
+        unsigned sum = 0;
+        memset(header.data() + 148, ' ', 8);
+        for (char c: header)
+            sum += static_cast<uchar>(c);
+        memcpy(header.data() + 148, QByteArray::number(sum, 8).rightJustified(6, '0').constData(), 6);
+        header[154] = '\0';
+
+        tar.append(header);
+        tar.append(file.value());
+        tar.append(QByteArray((512 - file.value().size() % 512) % 512, '\0'));
+    }
+    tar.append(QByteArray(1024, '\0'));
+    return tar;
+}
+
+/// The member named corrupt gets a wrong CRC-32
+QByteArray zipArchive(const Files& files, bool deflated, const QString& corrupt = QString())
+{
+    QByteArray zip, directory;
+    for (auto file = files.cbegin(); file != files.cend(); ++file)
+    {
+        const auto name = file.key().toUtf8();
+        const auto data = deflated ? deflateData(file.value(), -15) : file.value();
+        const auto offset = static_cast<quint32>(zip.size());
+
+        auto common = [&](QByteArray* out) {
+            put16(out, 20); // version needed
+            put16(out, 0x0800); // UTF-8 names
+            put16(out, deflated ? 8 : 0);
+            put16(out, 0); // time
+            put16(out, 0x21); // 1980-01-01
+            put32(out, crc(file.value()) ^ (file.key() == corrupt ? 1 : 0));
+            put32(out, static_cast<quint32>(data.size()));
+            put32(out, static_cast<quint32>(file.value().size()));
+            put16(out, static_cast<quint16>(name.size()));
+            put16(out, 0); // extra
+        };
+
+        put32(&zip, 0x04034b50);
+        common(&zip);
+        zip.append(name);
+        zip.append(data);
+
+        put32(&directory, 0x02014b50);
+        put16(&directory, 20); // version made by
+        common(&directory);
+        put16(&directory, 0); // comment
+        put16(&directory, 0); // disk
+        put16(&directory, 0); // internal attributes
+        put32(&directory, 0); // external attributes
+        put32(&directory, offset);
+        directory.append(name);
+    }
+
+    const auto directoryOffset = static_cast<quint32>(zip.size());
+    zip.append(directory);
+    put32(&zip, 0x06054b50);
+    put16(&zip, 0);
+    put16(&zip, 0);
+    put16(&zip, static_cast<quint16>(files.size()));
+    put16(&zip, static_cast<quint16>(files.size()));
+    put32(&zip, static_cast<quint32>(directory.size()));
+    put32(&zip, directoryOffset);
+    put16(&zip, 0);
+    return zip;
+}
+
+} // namespace
+
+/// Behavior of the collection components on small generated files
+class Tests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void sessionRoundTrip();
+
+    void archiveMembers_data();
+    void archiveMembers();
+
+    void zipChecksum_data();
+    void zipChecksum();
+
+    void externalSortRuns();
+
+    void sparseFile();
+
+    void identicalDirectories();
+
+    void filterBackreferences();
+
+    void shardedScan_data();
+    void shardedScan();
+
+private:
+    QTemporaryDir mTemp;
+};
+
+void Tests::initTestCase()
+{
+    QVERIFY(mTemp.isValid());
+}
+
+void Tests::sessionRoundTrip()
+{
+    Session session;
+    for (int i = 0; i < 4; ++i)
+    {
+        FileItem item{ QFileInfo(QString("/data/dir%1/file%2.bin").arg(i % 2).arg(i)), contents(20, i % 2) };
+        item.size = 1000 + i;
+        item.lastModified = QDateTime::fromMSecsSinceEpoch(1600000000000 + i);
+        item.isImage = i == 1;
+        item.imageHash = i == 1 ? 0x0123456789ABCDEF : 0;
+        item.isMember = i == 3;
+        session.items.append(item);
+    }
+
+    FileItem dir{ QFileInfo("/data/copy"), contents(20, 7) };
+    dir.isDir = true;
+    dir.size = 10;
+    session.items.append(dir);
+
+    FileItem inner{ QFileInfo("/data/copy/inner.txt"), contents(20, 8) };
+    inner.size = 10;
+    session.collapsed.insert("/data/copy", { inner });
+    session.roots = QStringList{ "/data" };
+
+    const auto fileName = mTemp.filePath("roundtrip.mdsession");
+    QVERIFY2(session.save(fileName), qPrintable(session.errorString()));
+
+    Session loaded;
+    QVERIFY2(loaded.load(fileName), qPrintable(loaded.errorString()));
+    QCOMPARE(loaded.items.size(), session.items.size());
+    for (int i = 0; i < session.items.size(); ++i)
+    {
+        const auto& expected = session.items[i];
+        const auto& actual = loaded.items[i];
+        QCOMPARE(actual.fileInfo.absoluteFilePath(), expected.fileInfo.absoluteFilePath());
+        QCOMPARE(actual.hash, expected.hash);
+        QCOMPARE(actual.size, expected.size);
+        QCOMPARE(actual.isDir, expected.isDir);
+        QCOMPARE(actual.isImage, expected.isImage);
+        QCOMPARE(actual.imageHash, expected.imageHash);
+        QCOMPARE(actual.isMember, expected.isMember);
+        if (!expected.isDir)
+            QCOMPARE(actual.lastModified, expected.lastModified);
+    }
+
+    QCOMPARE(loaded.collapsed.keys(), session.collapsed.keys());
+    QCOMPARE(loaded.collapsed["/data/copy"].size(), 1);
+    QCOMPARE(loaded.collapsed["/data/copy"].first().fileInfo.absoluteFilePath(), QString("/data/copy/inner.txt"));
+    QCOMPARE(loaded.collapsed["/data/copy"].first().hash, inner.hash);
+    QCOMPARE(loaded.roots, session.roots);
+}
+
+void Tests::archiveMembers_data()
+{
+    QTest::addColumn<QString>("suffix");
+
+    QTest::newRow("tar") << QString("tar");
+    QTest::newRow("tar.gz") << QString("tar.gz");
+    QTest::newRow("zip stored") << QString("zip");
+    QTest::newRow("zip deflated") << QString("deflated.zip");
+}
+
+void Tests::archiveMembers()
+{
+    QFETCH(QString, suffix);
+
+    // the members should get the same hashes as the extracted files
+    const Files files = {
+        { "empty.txt", {} },
+        { "small.txt", "hello\n" },
+        { "dir/random.bin", contents(300 * 1024, 1) },
+        { "dir/sub/zeros.bin", QByteArray(70000, '\0') },
+    };
+
+    const auto extracted = mTemp.filePath("extracted");
+    for (auto file = files.cbegin(); file != files.cend(); ++file)
+        QVERIFY(writeFile(extracted + '/' + file.key(), file.value()));
+
+    QByteArray archive;
+    if (suffix == "tar")
+        archive = tarArchive(files);
+    else if (suffix == "tar.gz")
+        archive = deflateData(tarArchive(files), 31);
+    else
+        archive = zipArchive(files, suffix.startsWith("deflated"));
+
+    const auto path = mTemp.filePath("archive." + suffix);
+    QVERIFY(writeFile(path, archive));
+
+    QVector<ArchiveReader::Member> members;
+    QString error;
+    QVERIFY2(ArchiveReader::read(path, 0, &members, &error), qPrintable(error));
+    QCOMPARE(members.size(), files.size());
+
+    for (const auto& member: qAsConst(members))
+    {
+        QVERIFY2(files.contains(member.name), qPrintable(member.name));
+        QCOMPARE(member.size, static_cast<qint64>(files[member.name].size()));
+        QCOMPARE(member.hash, hashOf(extracted + '/' + member.name));
+    }
+}
+
+void Tests::zipChecksum_data()
+{
+    QTest::addColumn<bool>("deflated");
+
+    QTest::newRow("stored") << false;
+    QTest::newRow("deflated") << true;
+}
+
+void Tests::zipChecksum()
+{
+    QFETCH(bool, deflated);
+
+    const Files files = {
+        { "good.txt", "good\n" },
+        { "bad.bin", contents(10000, 2) },
+    };
+    const auto path = mTemp.filePath(QString("corrupt-%1.zip").arg(deflated));
+    QVERIFY(writeFile(path, zipArchive(files, deflated, "bad.bin")));
+
+    // the damaged member is reported, the others are still read
+    QVector<ArchiveReader::Member> members;
+    QString error;
+    QVERIFY(!ArchiveReader::read(path, 0, &members, &error));
+    QVERIFY(!error.isEmpty());
+    QCOMPARE(members.size(), 1);
+    QCOMPARE(members[0].name, QString("good.txt"));
+}
+
+void Tests::externalSortRuns()
+{
+    // a tiny budget spills every few records, so the merge takes several passes
+    ExternalSort sort(1024);
+    QVector<ExternalSort::Record> expected;
+    for (int i = 0; i < 1000; ++i)
+    {
+        ExternalSort::Record record;
+        record.size = (i * 7919) % 97;
+        record.lastModified = i;
+        record.hash = contents(20, static_cast<quint32>(i % 13));
+        record.path = QString("/data/%1").arg(i);
+        expected.append(record);
+        QVERIFY2(sort.append(record), qPrintable(sort.errorString()));
+    }
+    QVERIFY(sort.runs() > ExternalSort::mcMaxFanIn);
+    std::sort(expected.begin(), expected.end());
+
+    QVector<ExternalSort::Record> merged;
+    const bool ok = sort.merge([&merged](const ExternalSort::Record& record) {
+        merged.append(record);
+        return true;
+    });
+    QVERIFY2(ok, qPrintable(sort.errorString()));
+
+    QCOMPARE(merged.size(), expected.size());
+    for (int i = 0; i < merged.size(); ++i)
+    {
+        QCOMPARE(merged[i].path, expected[i].path);
+        QCOMPARE(merged[i].size, expected[i].size);
+        QCOMPARE(merged[i].lastModified, expected[i].lastModified);
+        QCOMPARE(merged[i].hash, expected[i].hash);
+    }
+}
+
+void Tests::sparseFile()
+{
+    // data, a hole, data, a hole up to the end
+    constexpr qint64 cSize = 3 * TreeHash::mcChunkSize + 12345;
+    const auto head = contents(100000, 2);
+    const auto middle = contents(50000, 3);
+    constexpr qint64 cMiddle = TreeHash::mcChunkSize + 777;
+
+    const auto sparse = mTemp.filePath("sparse.bin");
+    {
+        QFile file(sparse);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QVERIFY(file.write(head) == head.size());
+        QVERIFY(file.seek(cMiddle));
+        QVERIFY(file.write(middle) == middle.size());
+        QVERIFY(file.resize(cSize));
+    }
+
+    QByteArray data(static_cast<int>(cSize), '\0');
+    data.replace(0, head.size(), head);
+    data.replace(static_cast<int>(cMiddle), middle.size(), middle);
+    const auto dense = mTemp.filePath("dense.bin");
+    QVERIFY(writeFile(dense, data));
+
+    QCOMPARE(hashOf(sparse), QCryptographicHash::hash(data, QCryptographicHash::Sha1));
+    QCOMPARE(hashOf(sparse), hashOf(dense));
+    QCOMPARE(hashOf(sparse, 1), hashOf(dense, 1));
+    QVERIFY(TreeHash::isTreeHash(hashOf(sparse, 1)));
+
+    // looking up the regions does not move the reading position
+    QFile file(sparse);
+    QVERIFY(file.open(QIODevice::ReadOnly | QIODevice::Unbuffered));
+    QCOMPARE(file.read(10), data.left(10));
+    qint64 size = 0;
+    QVector<SparseFile::Region> regions;
+    SparseFile::dataRegions(file.handle(), &size, &regions);
+    QCOMPARE(file.read(10), data.mid(10, 10));
+}
+
+void Tests::identicalDirectories()
+{
+    const auto root = mTemp.filePath("dirs");
+    for (const auto& copy: { "a", "b" })
+    {
+        QVERIFY(writeFile(root + '/' + copy + "/x.txt", "x"));
+        QVERIFY(writeFile(root + '/' + copy + "/sub/y.txt", contents(1000, 4)));
+    }
+    QVERIFY(writeFile(root + "/c/x.txt", "other"));
+
+    ScanOptions options;
+    options.directories = true;
+
+    QList<FileItem> items;
+    CollapsedDirs collapsed;
+    auto collect = [&] {
+        FileInfoModel::Collector collector(nullptr, options);
+        collector.collect({ QUrl::fromLocalFile(root) });
+        items = collector.collected();
+        collapsed = collector.collapsed();
+    };
+
+    collect();
+    QStringList dirs;
+    for (const auto& item: qAsConst(items))
+        if (item.isDir)
+            dirs.append(item.fileInfo.absoluteFilePath());
+    dirs.sort();
+    QCOMPARE(dirs, QStringList({ root + "/a", root + "/b" }));
+    QCOMPARE(collapsed.value(root + "/a").size(), 2);
+    QCOMPARE(collapsed.value(root + "/b").size(), 2);
+
+    // an empty subdirectory makes the copies different
+    QVERIFY(QDir().mkpath(root + "/b/empty"));
+    collect();
+    for (const auto& item: qAsConst(items))
+        QVERIFY2(!item.isDir, qPrintable(item.fileInfo.absoluteFilePath()));
+    QVERIFY(collapsed.isEmpty());
+}
+
+void Tests::filterBackreferences()
+{
+    // the glob and the expressions must not renumber each other's groups
+    ScanFilter::Rules rules;
+    rules.exclude = QStringList { "*.tmp", R"(re:^(\w+)/\1$)", R"(re:(a)(b)\2\1)" };
+    const ScanFilter filter(rules);
+    QVERIFY2(filter.errors().isEmpty(), qPrintable(filter.errors().join('\n')));
+
+    QVERIFY(!filter.acceptsDir("src/src"));
+    QVERIFY(filter.acceptsDir("src/lib"));
+    QVERIFY(!filter.acceptsFile("x/abba"));
+    QVERIFY(filter.acceptsFile("x/abab"));
+    QVERIFY(!filter.acceptsFile("x/y.tmp"));
+    QVERIFY(filter.acceptsFile("x/y.txt"));
+}
+
+void Tests::shardedScan_data()
+{
+    QTest::addColumn<bool>("kill");
+
+    QTest::newRow("workers") << false;
+    QTest::newRow("killed workers") << true;
+}
+
+void Tests::shardedScan()
+{
+    QFETCH(bool, kill);
+#ifndef Q_OS_UNIX
+    if (kill)
+        QSKIP("Workers are killed with SIGKILL");
+#endif
+
+    const auto root = mTemp.filePath("shards");
+    TreeGenerator::Parameters parameters;
+    parameters.files = 300;
+    parameters.maxSize = 16 * 1024;
+    QList<QUrl> roots;
+    for (const auto& name: { "one", "two", "three" })
+    {
+        QVERIFY(TreeGenerator::generate(root + '/' + name, parameters));
+        roots.append(QUrl::fromLocalFile(root + '/' + name));
+        ++parameters.seed;
+    }
+
+    // path --> hash and size
+    using Scanned = QMap<QString, QPair<QByteArray, qint64>>;
+    auto collect = [&roots](const ScanOptions& options, QStringList* warnings) {
+        FileInfoModel::Collector collector(nullptr, options);
+        collector.collect(roots);
+        Scanned scanned;
+        for (const auto& item: collector.collected())
+            scanned.insert(item.fileInfo.absoluteFilePath(), qMakePair(item.hash, item.size));
+        *warnings = collector.warnings();
+        return scanned;
+    };
+
+    QStringList warnings;
+    const auto expected = collect(ScanOptions(), &warnings);
+    QCOMPARE(expected.size(), 3 * parameters.files);
+
+    // the roots of the killed workers are scanned in this process
+    ScanOptions options;
+    options.workers = 2;
+    if (kill)
+        qputenv(cKillWorkers, "1");
+    const auto merged = collect(options, &warnings);
+    qunsetenv(cKillWorkers);
+
+    QCOMPARE(merged, expected);
+    const bool fallback = std::any_of(warnings.cbegin(), warnings.cend(), [](const QString& warning) {
+        return warning.contains("scanning in this process");
+    });
+    QCOMPARE(fallback, kill);
+}
+
+int main(int argc, char* argv[])
+{
+    // ShardedScan starts this executable as its workers
+    if (argc == 4 && qstrcmp(argv[1], ShardedScan::mcWorkerArgument) == 0)
+    {
+#ifdef Q_OS_UNIX
+        if (qEnvironmentVariableIsSet(cKillWorkers))
+            kill(getpid(), SIGKILL);
+#endif
+        QCoreApplication worker(argc, argv);
+        return ShardedScan::worker(QString::fromLocal8Bit(argv[2]), QByteArray(argv[3]).toInt());
+    }
+
+    QApplication application(argc, argv);
+    Tests tests;
+    QTEST_SET_MAIN_SOURCE_PATH
+    return QTest::qExec(&tests, argc, argv);
+}
+
+#include "tests.moc"
@@ -0,0 +1,65 @@
+#-------------------------------------------------
+#
+# Unit tests of the collection components
+#
+# Build and run:
+#   qmake tests.pro && make && ./multidiff-tests
+# Use -platform offscreen on machines without display
+#
+#-------------------------------------------------
+
+QT       += core gui widgets concurrent network testlib
+
+TARGET = multidiff-tests
+TEMPLATE = app
+CONFIG += c++14 console testcase
+CONFIG -= app_bundle
+
+LIBS += -lz
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += \
+    ../benchmark \
+    ../source \
+
+SOURCES += \
+    tests.cpp \
+    ../benchmark/treegenerator.cpp \
+    ../source/archivereader.cpp \
+    ../source/dirwatcher.cpp \
+    ../source/externalsort.cpp \
+    ../source/fileinfomodel.cpp \
+    ../source/filelist.cpp \
+    ../source/imagehash.cpp \
+    ../source/ioscheduler.cpp \
+    ../source/profiler.cpp \
+    ../source/progress.cpp \
+    ../source/referencecache.cpp \
+    ../source/scanfilter.cpp \
+    ../source/session.cpp \
+    ../source/shardedscan.cpp \
+    ../source/sparsefile.cpp \
+    ../source/statusmessage.cpp \
+    ../source/throttle.cpp \
+    ../source/treehash.cpp
+
+HEADERS += \
+    ../benchmark/treegenerator.h \
+    ../source/archivereader.h \
+    ../source/dirwatcher.h \
+    ../source/externalsort.h \
+    ../source/fileinfomodel.h \
+    ../source/filelist.h \
+    ../source/imagehash.h \
+    ../source/ioscheduler.h \
+    ../source/profiler.h \
+    ../source/progress.h \
+    ../source/referencecache.h \
+    ../source/scanfilter.h \
+    ../source/session.h \
+    ../source/shardedscan.h \
+    ../source/sparsefile.h \
+    ../source/statusmessage.h \
+    ../source/throttle.h \
+    ../source/treehash.h